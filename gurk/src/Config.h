@@ -1,14 +1,24 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "Debounce.h"
+
 extern const int pinLED;
 extern const int pinInput;
+extern const int pinFlow;
+extern const float flowPulsesPerLitre;
 extern const unsigned long maxOnDuration;
+extern const int errorTimeout;
+extern const unsigned long wateringTolerance;
+extern const uint8_t wakeLatencyPercentile;
+extern const DebounceMode switchDebounceMode;
+extern const uint8_t switchDebounceSamples;
+extern const uint32_t loadCurrentUa[]; // indexed by PowerLoad, see Energy.h
 
 extern const char *ssid;
 extern const char *password;
 extern const char *serverUrl;
-extern const char *noButtonSignalUrl;
+extern const char *eventsUrl;
 extern const char *logLightStatusUrl;
 
 #endif
@@ -0,0 +1,68 @@
+#include "Debounce.h"
+#include "Config.h"
+
+static DebounceFilter switchFilter;
+static int switchPin = -1;
+static void (*edgeHandler)(const SwitchEdge &edge) = nullptr;
+static uint32_t edgesSeen = 0;
+
+static void IRAM_ATTR onSwitchSample()
+{
+    if (!debounceSample(switchFilter, digitalRead(switchPin)))
+    {
+        return;
+    }
+
+    SwitchEdge edge;
+    edge.level = switchFilter.level;
+    edge.at = micros() - (switchFilter.count - switchFilter.changedAt) * SWITCH_SAMPLE_US;
+    edgesSeen++;
+    if (edgeHandler)
+    {
+        edgeHandler(edge);
+    }
+}
+
+void switchBegin(int pin, void (*onEdge)(const SwitchEdge &edge))
+{
+    switchPin = pin;
+    edgeHandler = onEdge;
+    edgesSeen = 0;
+    debounceReset(switchFilter, switchDebounceMode, switchDebounceSamples, readSwitch(pin));
+
+    // 80 MHz / 16 is 5 ticks per microsecond
+    timer1_attachInterrupt(onSwitchSample);
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+    timer1_write(SWITCH_SAMPLE_US * 5);
+}
+
+void switchEnd()
+{
+    timer1_disable();
+    timer1_detachInterrupt();
+}
+
+int switchLevel()
+{
+    return switchFilter.level;
+}
+
+uint32_t switchBounces()
+{
+    // Every edge is one raw transition, anything beyond that bounced
+    return switchFilter.rawChanges > edgesSeen ? switchFilter.rawChanges - edgesSeen : 0;
+}
+
+int readSwitch(int pin)
+{
+    // Starting from one raw reading, enough samples for the filter to have
+    // moved off it if that reading was a bounce
+    DebounceFilter filter;
+    debounceReset(filter, switchDebounceMode, switchDebounceSamples, digitalRead(pin));
+    for (uint8_t i = 0; i < filter.samples * 2 + 1; i++)
+    {
+        delayMicroseconds(SWITCH_SAMPLE_US);
+        debounceSample(filter, digitalRead(pin));
+    }
+    return filter.level;
+}
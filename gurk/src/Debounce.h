@@ -0,0 +1,25 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <Arduino.h>
+#include "DebounceFilter.h"
+
+// A debounced edge on the valve switch
+struct SwitchEdge
+{
+    uint8_t level;
+    uint32_t at; // micros() the raw input first moved to level
+};
+
+// Samples pin every SWITCH_SAMPLE_US from hardware timer 1 and runs it
+// through the filter configured in main.cpp. onEdge, if given, is called from
+// the timer interrupt on every clean edge, so it must be IRAM_ATTR.
+const uint32_t SWITCH_SAMPLE_US = 1000;
+
+void switchBegin(int pin, void (*onEdge)(const SwitchEdge &edge) = nullptr);
+void switchEnd();
+int switchLevel();
+uint32_t switchBounces(); // raw transitions that never made it to an edge
+int readSwitch(int pin);  // one debounced reading, blocks a few ms
+
+#endif
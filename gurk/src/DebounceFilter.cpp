@@ -0,0 +1,68 @@
+#include "DebounceFilter.h"
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#define IRAM_ATTR // host builds
+#endif
+
+void debounceReset(DebounceFilter &filter, DebounceMode mode, uint8_t samples, int level)
+{
+    filter.mode = mode;
+    filter.samples = samples < 1 ? 1 : samples > 32 ? 32 : samples;
+    filter.level = level;
+    filter.raw = level;
+    filter.run = 0;
+    filter.window = level ? 0xFFFFFFFF : 0;
+    filter.count = 0;
+    filter.changedAt = 0;
+    filter.pending = false;
+    filter.rawChanges = 0;
+}
+
+bool IRAM_ATTR debounceSample(DebounceFilter &filter, int raw)
+{
+    raw = raw ? 1 : 0;
+    filter.count++;
+    if (raw != filter.raw)
+    {
+        filter.raw = raw;
+        filter.rawChanges++;
+    }
+    if (raw == filter.level)
+    {
+        filter.pending = false; // a bounce, the input went back
+    }
+    else if (!filter.pending)
+    {
+        filter.pending = true;
+        filter.changedAt = filter.count;
+    }
+
+    bool changed = false;
+    if (filter.mode == DEBOUNCE_STABLE_TIME)
+    {
+        if (raw == filter.level)
+        {
+            filter.run = 0;
+        }
+        else if (++filter.run >= filter.samples)
+        {
+            filter.run = 0;
+            changed = true;
+        }
+    }
+    else
+    {
+        uint32_t mask = filter.samples == 32 ? 0xFFFFFFFF : (1UL << filter.samples) - 1;
+        filter.window = ((filter.window << 1) | raw) & mask;
+        uint8_t ones = __builtin_popcount(filter.window);
+        changed = filter.level ? ones * 2 < filter.samples : ones * 2 > filter.samples;
+    }
+
+    if (changed)
+    {
+        filter.level = !filter.level;
+        filter.pending = false;
+    }
+    return changed;
+}
@@ -0,0 +1,31 @@
+#ifndef DEBOUNCE_FILTER_H
+#define DEBOUNCE_FILTER_H
+
+#include <stdint.h>
+
+enum DebounceMode : uint8_t
+{
+    DEBOUNCE_STABLE_TIME, // the new level must hold for `samples` samples in a row
+    DEBOUNCE_MAJORITY,    // the level most of the last `samples` samples had, at most 32
+};
+
+// Debounce state for one input. The filter is plain logic over the samples
+// it is fed, so it does not care where they come from.
+struct DebounceFilter
+{
+    DebounceMode mode;
+    uint8_t samples;
+    uint8_t level;       // debounced output
+    uint8_t run;         // stable mode: samples in a row away from level
+    uint32_t window;     // majority mode: last samples, newest in bit 0
+    uint32_t count;      // samples taken
+    uint32_t changedAt;  // sample the raw input first left level, if pending
+    bool pending;        // raw input has left level since the last edge
+    uint32_t rawChanges; // raw transitions, bounces included
+    uint8_t raw;
+};
+
+void debounceReset(DebounceFilter &filter, DebounceMode mode, uint8_t samples, int level);
+bool debounceSample(DebounceFilter &filter, int raw); // true when the output changed
+
+#endif
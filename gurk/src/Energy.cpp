@@ -0,0 +1,126 @@
+#include "Energy.h"
+#include "Config.h"
+
+static const char *LOAD_NAMES[LOAD_COUNT] = {"cpu", "radio", "tx", "light", "deep", "motor"};
+
+static_assert(rtcBlocks(sizeof(EnergyUse)) <= RTC_SLOT_DRIFT - RTC_SLOT_ENERGY, "Energy use outgrew its RTC slot");
+
+static EnergyUse use;
+static unsigned long cpuSince = 0; // millis() the CPU time was last counted up to
+static uint32_t lightSinceCpu = 0; // light sleep millis() counted since, which is not CPU time
+static uint32_t wakeStartUah = 0; // energyMicroampHours() when this wake began
+static bool loadOn[LOAD_COUNT] = {false};
+static unsigned long loadSince[LOAD_COUNT] = {0};
+
+void energyBegin()
+{
+    if (!rtcLoad(RTC_SLOT_ENERGY, &use, sizeof(use)))
+    {
+        memset(&use, 0, sizeof(use));
+    }
+    cpuSince = 0; // the CPU has been up since boot
+    lightSinceCpu = 0;
+    wakeStartUah = energyMicroampHours(use);
+}
+
+void powerOn(PowerLoad load)
+{
+    if (!loadOn[load])
+    {
+        loadOn[load] = true;
+        loadSince[load] = millis();
+    }
+}
+
+void powerOff(PowerLoad load)
+{
+    if (loadOn[load])
+    {
+        use.ms[load] += millis() - loadSince[load];
+        loadOn[load] = false;
+    }
+}
+
+void powerAdd(PowerLoad load, uint32_t ms, uint32_t millisCounted)
+{
+    use.ms[load] += ms;
+    if (load == LOAD_LIGHT_SLEEP)
+    {
+        lightSinceCpu += millisCounted;
+    }
+}
+
+// Brings the CPU time and any load still running up to now
+static void countUpToNow()
+{
+    unsigned long nowMs = millis();
+    unsigned long awakeMs = nowMs - cpuSince;
+    use.ms[LOAD_CPU] += awakeMs > lightSinceCpu ? awakeMs - lightSinceCpu : 0;
+    cpuSince = nowMs;
+    lightSinceCpu = 0;
+
+    for (uint8_t i = 0; i < LOAD_COUNT; i++)
+    {
+        if (loadOn[i])
+        {
+            use.ms[i] += nowMs - loadSince[i];
+            loadSince[i] = nowMs;
+        }
+    }
+}
+
+void energySave()
+{
+    countUpToNow();
+    rtcSave(RTC_SLOT_ENERGY, &use, sizeof(use));
+}
+
+const EnergyUse &energyUse()
+{
+    countUpToNow();
+    return use;
+}
+
+uint32_t energyMicroampHours(const EnergyUse &use)
+{
+    uint64_t microampMs = 0;
+    for (uint8_t i = 0; i < LOAD_COUNT; i++)
+    {
+        microampMs += (uint64_t)use.ms[i] * loadCurrentUa[i];
+    }
+    return microampMs / 3600000;
+}
+
+void clearEnergyUse()
+{
+    countUpToNow();
+    memset(&use, 0, sizeof(use));
+    wakeStartUah = 0;
+    rtcSave(RTC_SLOT_ENERGY, &use, sizeof(use));
+}
+
+// One line, e.g. "Energy ms: cpu=5120 radio=3890 tx=410 light=0 deep=14400000 motor=4200 -> 412 uAh"
+void printEnergyUse()
+{
+    countUpToNow();
+    Serial.print("Energy ms:");
+    for (uint8_t i = 0; i < LOAD_COUNT; i++)
+    {
+        Serial.printf(" %s=%u", LOAD_NAMES[i], use.ms[i]);
+    }
+    Serial.printf(" -> %u uAh\n", energyMicroampHours(use));
+}
+
+// e.g. "Energy this cycle: 96 uAh, 71 uAh of it awake"
+void printCycleEnergy()
+{
+    countUpToNow();
+    uint32_t totalUah = energyMicroampHours(use);
+    // An upload clears the totals and starts both counts again from zero
+    uint32_t cycleUah = totalUah - min(use.cycleStartUah, totalUah);
+    uint32_t wakeUah = totalUah - min(wakeStartUah, totalUah);
+    Serial.printf("Energy this cycle: %u uAh, %u uAh of it awake\n", cycleUah, wakeUah);
+    use.cycleStartUah = totalUah;
+    wakeStartUah = totalUah;
+    rtcSave(RTC_SLOT_ENERGY, &use, sizeof(use));
+}
@@ -0,0 +1,45 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <Arduino.h>
+#include "RtcMemory.h"
+
+// Loads are timed independently and their currents add up, so the radio and
+// the motor may overlap (as they do while homing during association). The
+// current of each is configured in main.cpp.
+enum PowerLoad : uint8_t
+{
+    LOAD_CPU,         // awake and not in light sleep
+    LOAD_RADIO,       // radio up, receiving or listening; on top of the CPU
+    LOAD_TX,          // TLS handshakes and request writes; on top of the radio
+    LOAD_LIGHT_SLEEP, // forced light sleep
+    LOAD_DEEP_SLEEP,  // deep sleep
+    LOAD_MOTOR,       // valve motor running
+    LOAD_COUNT,
+};
+
+// ms spent in each load since the last upload, kept in RTC memory so the
+// deep sleeps in between are counted too
+struct EnergyUse
+{
+    uint32_t ms[LOAD_COUNT];
+    uint32_t cycleStartUah; // energyMicroampHours() when the last cycle was reported
+};
+
+void energyBegin(); // early in setup(), right after clockBegin()
+void powerOn(PowerLoad load);
+void powerOff(PowerLoad load);
+// Adds ms that were not timed with powerOn()/powerOff(). millisCounted is the
+// part of it millis() also moved on for, which is not CPU time.
+void powerAdd(PowerLoad load, uint32_t ms, uint32_t millisCounted = 0);
+void energySave(); // counts everything up to now, call before deep sleep
+const EnergyUse &energyUse();
+uint32_t energyMicroampHours(const EnergyUse &use);
+void clearEnergyUse();
+void printEnergyUse();
+// Prints the energy used since the last call, so the sleep before this wake
+// included, and how much of that was spent awake. Called each time the radio
+// goes off, which is once per wake in the usual poll.
+void printCycleEnergy();
+
+#endif
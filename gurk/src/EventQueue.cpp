@@ -0,0 +1,142 @@
+#include "EventQueue.h"
+#include "Energy.h"
+
+struct EventQueue
+{
+    uint32_t epoch;
+    uint8_t head;
+    uint8_t count;
+    uint16_t dropped;
+    Event events[EVENT_QUEUE_SIZE];
+};
+
+static_assert(rtcBlocks(sizeof(EventQueue)) <= RTC_SLOT_RETRY - RTC_SLOT_EVENTS, "Event queue outgrew its RTC slot");
+
+const uint32_t ENERGY_REPORT_MS = 86400000; // report energy use on its own once a day of tracked time
+
+// dropped, events, timings and energy, each event an [age, type, value] array
+const size_t EVENT_DOC_SIZE = JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(EVENT_QUEUE_SIZE) +
+                              EVENT_QUEUE_SIZE * JSON_ARRAY_SIZE(3) + JSON_ARRAY_SIZE(PHASE_COUNT) +
+                              JSON_ARRAY_SIZE(LOAD_COUNT + 1);
+
+static EventQueue queue;
+static bool queueLoaded = false;
+
+static void loadQueue()
+{
+    if (queueLoaded)
+    {
+        return;
+    }
+
+    if (!rtcLoad(RTC_SLOT_EVENTS, &queue, sizeof(queue)))
+    {
+        memset(&queue, 0, sizeof(queue));
+        queue.epoch = clockEpoch();
+    }
+    else if (queue.epoch != clockEpoch())
+    {
+        // Timestamps from before a clock reset can't be turned into an age
+        for (Event &event : queue.events)
+        {
+            event.timestamp = EVENT_TIME_UNKNOWN;
+        }
+        queue.epoch = clockEpoch();
+    }
+    queueLoaded = true;
+}
+
+void queueEvent(EventType type, int16_t value)
+{
+    loadQueue();
+
+    if (queue.count == EVENT_QUEUE_SIZE)
+    {
+        queue.head = (queue.head + 1) % EVENT_QUEUE_SIZE;
+        queue.count--;
+        queue.dropped++;
+    }
+
+    Event &event = queue.events[(queue.head + queue.count) % EVENT_QUEUE_SIZE];
+    event.timestamp = clockNow() / 1000;
+    event.type = type;
+    event.value = value;
+    queue.count++;
+    rtcSave(RTC_SLOT_EVENTS, &queue, sizeof(queue));
+
+    Serial.printf("Queued event %u (%d), %u waiting\n", type, value, queue.count);
+}
+
+// Sends every queued event in one POST as {"dropped": n, "events": [[age, type, value], ...]}
+// with age in seconds, or -1 if unknown. The latest wake phase timings ride
+// along as "timings": [assoc, dhcp, dns, tls, ttfb, decode] in microseconds,
+// and the time per power load since the last upload as
+// "energy": [cpu, radio, tx, light, deep, motor, uAh] in milliseconds.
+bool flushEvents(const char *url)
+{
+    loadQueue();
+    const EnergyUse &use = energyUse();
+    uint32_t trackedMs = use.ms[LOAD_CPU] + use.ms[LOAD_LIGHT_SLEEP] + use.ms[LOAD_DEEP_SLEEP];
+    if (queue.count == 0 && queue.dropped == 0 && trackedMs < ENERGY_REPORT_MS)
+    {
+        return true;
+    }
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        return false;
+    }
+
+    uint32_t now = clockNow() / 1000;
+    StaticJsonDocument<EVENT_DOC_SIZE> doc;
+    doc["dropped"] = queue.dropped;
+    JsonArray events = doc.createNestedArray("events");
+    for (uint8_t i = 0; i < queue.count; i++)
+    {
+        const Event &event = queue.events[(queue.head + i) % EVENT_QUEUE_SIZE];
+        JsonArray entry = events.createNestedArray();
+        entry.add(event.timestamp == EVENT_TIME_UNKNOWN ? -1 : (long)(now - event.timestamp));
+        entry.add((uint8_t)event.type);
+        entry.add(event.value);
+    }
+    bool timingsPending = wakeTimingsPending();
+    if (timingsPending)
+    {
+        JsonArray timings = doc.createNestedArray("timings");
+        for (uint32_t us : wakeTimings().us)
+        {
+            timings.add(us);
+        }
+    }
+
+    JsonArray energy = doc.createNestedArray("energy");
+    for (uint32_t ms : use.ms)
+    {
+        energy.add(ms);
+    }
+    energy.add(energyMicroampHours(use));
+    if (doc.overflowed())
+    {
+        // Clearing after a truncated upload would lose what did not fit
+        Serial.printf("Event document overflowed %u bytes, keeping %u events\n", (unsigned)EVENT_DOC_SIZE, queue.count);
+        return false;
+    }
+
+    int httpCode = postDocument(url, doc);
+    if (httpCode < 200 || httpCode >= 300)
+    {
+        Serial.printf("Event upload failed (%d), keeping %u events\n", httpCode, queue.count);
+        return false;
+    }
+
+    Serial.printf("Uploaded %u events (%u dropped)\n", queue.count, queue.dropped);
+    queue.head = 0;
+    queue.count = 0;
+    queue.dropped = 0;
+    rtcSave(RTC_SLOT_EVENTS, &queue, sizeof(queue));
+    if (timingsPending)
+    {
+        clearWakeTimings();
+    }
+    clearEnergyUse();
+    return true;
+}
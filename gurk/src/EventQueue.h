@@ -0,0 +1,35 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <Arduino.h>
+#include "RtcMemory.h"
+#include "Utils.h"
+#include "HTTPHandler.h"
+#include "WakeTimings.h"
+
+enum EventType : uint8_t
+{
+    EVENT_WATERING = 1,         // value: 1 when the valve opened, 0 when it closed
+    EVENT_NO_BUTTON_SIGNAL = 2, // value: the switch level we were waiting for
+    EVENT_VALVE_SLOW = 3,       // value: average travel ms, negative when closing
+    EVENT_WATER_VOLUME = 4,     // value: decilitres delivered by the last watering
+};
+
+const uint8_t EVENT_QUEUE_SIZE = 8;
+const uint32_t EVENT_TIME_UNKNOWN = 0xFFFFFFFF; // queued before a clock reset
+
+struct Event
+{
+    uint32_t timestamp; // clockNow() in seconds
+    EventType type;
+    uint8_t reserved;
+    int16_t value;
+};
+
+// Events wait in RTC memory until the next upload, so they survive deep sleep
+// and WiFi outages. When the queue is full the oldest event is dropped and
+// counted.
+void queueEvent(EventType type, int16_t value);
+bool flushEvents(const char *url);
+
+#endif
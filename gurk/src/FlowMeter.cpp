@@ -0,0 +1,41 @@
+#include "FlowMeter.h"
+#include "Config.h"
+
+static volatile uint32_t flowPulses = 0;
+static bool counting = false;
+
+static void IRAM_ATTR onFlowPulse()
+{
+    flowPulses++;
+}
+
+bool flowMeterFitted()
+{
+    return pinFlow >= 0;
+}
+
+void flowBegin()
+{
+    if (!flowMeterFitted() || counting)
+    {
+        return;
+    }
+    flowPulses = 0;
+    pinMode(pinFlow, INPUT_PULLUP); // open collector output
+    attachInterrupt(digitalPinToInterrupt(pinFlow), onFlowPulse, FALLING);
+    counting = true;
+}
+
+void flowEnd()
+{
+    if (counting)
+    {
+        detachInterrupt(digitalPinToInterrupt(pinFlow));
+        counting = false;
+    }
+}
+
+uint32_t flowMillilitres()
+{
+    return flowPulses * 1000.0f / flowPulsesPerLitre;
+}
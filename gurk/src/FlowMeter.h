@@ -0,0 +1,14 @@
+#ifndef FLOW_METER_H
+#define FLOW_METER_H
+
+#include <Arduino.h>
+
+// Hall-effect flow meter on pinFlow, counted from an interrupt while the
+// valve is open. Calibrated by flowPulsesPerLitre; pinFlow is -1 when no
+// meter is fitted.
+bool flowMeterFitted();
+void flowBegin(); // starts counting from zero, unless already counting
+void flowEnd();
+uint32_t flowMillilitres();
+
+#endif
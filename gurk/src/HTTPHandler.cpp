@@ -1,23 +1,155 @@
 #include "HTTPHandler.h"
 
-String sendRequestToServer(const char *serverUrl)
+// Last decoded device variables and their ETag, so an unchanged schedule can
+// be answered with 304 Not Modified instead of a full body
+struct DeviceVariablesCache
 {
-    WiFiClientSecure client;
-    HTTPClient https;
-    String payload = "error";
-    client.setInsecure(); // Disable SSL certificate verification
+    uint64_t fetchedAt; // clockNow() when the variables were decoded
+    uint32_t epoch;
+    DeviceVariables vars;
+    char etag[20]; // the server's are 18 characters with quotes
+};
 
-    if (https.begin(client, serverUrl))
+static_assert(rtcBlocks(sizeof(DeviceVariablesCache)) <= RTC_SLOT_EVENTS - RTC_SLOT_VARIABLES, "Device variables cache outgrew its RTC slot");
+
+// Every key is copied into the document before the filter sees it, so a
+// field we drop still needs room for its name. app.py's longest today is
+// next_watering_time; a longer one would fail every decode with NoMemory.
+const size_t MAX_DROPPED_KEY_LENGTH = 48;
+const size_t VARIABLES_DOC_SLACK = 16;
+
+// Slots for the four fields and the copies of their names, room to read the
+// name of one dropped field, and slack
+const size_t VARIABLES_DOC_SIZE = JSON_OBJECT_SIZE(4) + sizeof("time_until_watering") + sizeof("watering_time") +
+                                  sizeof("sleep_time") + sizeof("watering_volume") + MAX_DROPPED_KEY_LENGTH + 1 +
+                                  VARIABLES_DOC_SLACK;
+
+// Parses the body straight off the socket, as MessagePack when the server
+// picked it and as JSON otherwise. Only the fields we use are kept, so
+// the document stays small whatever else the server sends.
+static bool decodeDeviceVariables(Stream &body, bool msgpack, DeviceVariables &vars)
+{
+    StaticJsonDocument<JSON_OBJECT_SIZE(4)> filter; // the keys are literals, kept by pointer
+    filter["time_until_watering"] = true;
+    filter["watering_time"] = true;
+    filter["sleep_time"] = true;
+    filter["watering_volume"] = true;
+
+    unsigned long startTime = micros();
+    StaticJsonDocument<VARIABLES_DOC_SIZE> doc;
+    DeserializationError error = msgpack ? deserializeMsgPack(doc, body, DeserializationOption::Filter(filter))
+                                         : deserializeJson(doc, body, DeserializationOption::Filter(filter));
+    if (!error && (filter.overflowed() || doc.overflowed()))
     {
-        int httpCode = https.GET();
-        if (httpCode > 0)
+        error = DeserializationError::NoMemory;
+    }
+    if (error)
+    {
+        Serial.print(msgpack ? "deserializeMsgPack() failed: " : "deserializeJson() failed: ");
+        Serial.println(error.f_str());
+        return false;
+    }
+
+    vars.time_until_watering = doc["time_until_watering"].as<int32_t>();
+    vars.watering_time = doc["watering_time"].as<uint32_t>();
+    vars.sleep_time = doc["sleep_time"].as<int32_t>();
+    vars.watering_volume = doc["watering_volume"].as<float>();
+    unsigned long decodeTime = micros() - startTime;
+    recordPhase(PHASE_DECODE, decodeTime);
+    Serial.printf("Decoded device variables (%s) in %lu us\n", msgpack ? "msgpack" : "json", decodeTime);
+    return true;
+}
+
+static DeviceVariablesCache variablesCache;
+static bool variablesCached = false;
+
+bool requestDeviceVariables(const char *serverUrl)
+{
+    variablesCached = rtcLoad(RTC_SLOT_VARIABLES, &variablesCache, sizeof(variablesCache)) &&
+                      variablesCache.epoch == clockEpoch();
+    return serverSession.start("GET", serverUrl, nullptr, nullptr, 0, variablesCached ? variablesCache.etag : nullptr);
+}
+
+bool receiveDeviceVariables(DeviceVariables &vars)
+{
+    DeviceVariablesCache &cache = variablesCache;
+    bool decoded = false;
+
+    int httpCode = serverSession.status();
+    if (httpCode == HTTP_CODE_NOT_MODIFIED && variablesCached)
+    {
+        // Same schedule as last time; only the countdown has moved on
+        vars = cache.vars;
+        vars.time_until_watering -= (clockNow() - cache.fetchedAt) / 1000;
+        Serial.printf("Device variables not modified (%s)\n", cache.etag);
+        decoded = true;
+    }
+    else if (httpCode == HTTP_CODE_OK)
+    {
+        bool msgpack = strncmp(serverSession.contentType(), "application/msgpack", 19) == 0;
+        decoded = decodeDeviceVariables(serverSession.body(), msgpack, vars);
+        const char *etag = serverSession.etag();
+        if (decoded && etag[0] != '\0' && strlen(etag) < sizeof(cache.etag))
         {
-            if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_MOVED_PERMANENTLY)
-            {
-                String payload = https.getString();
-            }
+            cache.fetchedAt = clockNow();
+            cache.epoch = clockEpoch();
+            cache.vars = vars;
+            strncpy(cache.etag, etag, sizeof(cache.etag));
+            rtcSave(RTC_SLOT_VARIABLES, &cache, sizeof(cache));
         }
-        https.end();
+        else
+        {
+            rtcClear(RTC_SLOT_VARIABLES);
+        }
+    }
+    serverSession.end();
+    return decoded;
+}
+
+bool fetchDeviceVariables(const char *serverUrl, DeviceVariables &vars, void (*whileWaiting)())
+{
+    if (!requestDeviceVariables(serverUrl))
+    {
+        return false;
+    }
+    serverSession.wait(whileWaiting);
+    return receiveDeviceVariables(vars);
+}
+
+// Posts doc as MessagePack, or as JSON if the server does not take it. A
+// body that does not fit the buffer is not sent at all, rather than cut off,
+// and fails with HTTPC_ERROR_TOO_LESS_RAM.
+int postDocument(const char *url, const JsonDocument &doc)
+{
+    uint8_t payload[384];
+    int httpCode = HTTPC_ERROR_TOO_LESS_RAM;
+    size_t size = measureMsgPack(doc);
+    if (size <= sizeof(payload))
+    {
+        serializeMsgPack(doc, payload, sizeof(payload));
+        httpCode = serverSession.post(url, "application/msgpack", payload, size);
+    }
+    if (httpCode == HTTP_CODE_UNSUPPORTED_MEDIA_TYPE)
+    {
+        serverSession.end();
+        httpCode = HTTPC_ERROR_TOO_LESS_RAM;
+        size = measureJson(doc);
+        if (size < sizeof(payload)) // serializeJson() also writes a terminator
+        {
+            serializeJson(doc, payload, sizeof(payload));
+            httpCode = serverSession.post(url, "application/json", payload, size);
+        }
+    }
+    if (httpCode == HTTPC_ERROR_TOO_LESS_RAM)
+    {
+        Serial.printf("Body of %u bytes does not fit %u, not sent\n", (unsigned)size, (unsigned)sizeof(payload));
+    }
+
+    if (httpCode < 0)
+    {
+        Serial.print("Error on HTTP request: ");
+        Serial.println(HTTPClient::errorToString(httpCode).c_str());
     }
-    return payload;
-}
\ No newline at end of file
+    serverSession.end();
+    return httpCode;
+}
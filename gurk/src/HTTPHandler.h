@@ -1,10 +1,28 @@
 #ifndef HTTPHANDLER_H
 #define HTTPHANDLER_H
 
-#include <ESP8266HTTPClient.h>
 #include "WiFiManager.h"
+#include "RtcMemory.h"
+#include "Utils.h"
+#include "ServerSession.h"
 #include "../lib/ESP8266Ping-master/src/ESP8266Ping.h"
+#include "../lib/ArduinoJson-v6.21.5.h"
 
-String sendRequestToServer(const char *serverUrl);
+// Values from get_device_variables, in the units the server sends them
+struct DeviceVariables
+{
+    int32_t time_until_watering; // seconds
+    uint32_t watering_time;      // minutes
+    int32_t sleep_time;          // seconds
+    float watering_volume;       // litres, 0 to water for watering_time instead
+};
+
+bool fetchDeviceVariables(const char *serverUrl, DeviceVariables &vars, void (*whileWaiting)() = nullptr);
+
+// The same fetch split in two, for callers that drive serverSession.tick()
+// themselves: start it, tick until it returns false, then decode
+bool requestDeviceVariables(const char *serverUrl);
+bool receiveDeviceVariables(DeviceVariables &vars);
+int postDocument(const char *url, const JsonDocument &doc);
 
 #endif
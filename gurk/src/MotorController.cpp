@@ -0,0 +1,82 @@
+#include "MotorController.h"
+
+MotorController::MotorController(MotorIo &io, unsigned long timeout, int openLevel)
+    : io(io), timeout(timeout), openLevel(openLevel)
+{
+}
+
+bool MotorController::open()
+{
+    return start(openLevel, MOTOR_OPENING, MOTOR_OPEN);
+}
+
+bool MotorController::close()
+{
+    return start(!openLevel, MOTOR_CLOSING, MOTOR_CLOSED);
+}
+
+bool MotorController::nudge(unsigned long ms)
+{
+    if (busy())
+    {
+        return false;
+    }
+    target = MOTOR_NO_SWITCH;
+    runFor = ms;
+    startedAt = io.now();
+    motorState = MOTOR_NUDGING;
+    io.startMotor(MOTOR_NO_SWITCH);
+    return true;
+}
+
+bool MotorController::start(int level, MotorState travelling, MotorState arrived)
+{
+    if (busy())
+    {
+        return false;
+    }
+    target = level;
+    arrivedState = arrived;
+    startedAt = io.now();
+    lastTravel = 0;
+    if (io.readSwitch() == level)
+    {
+        // Already there, no need to move
+        motorState = arrived;
+        return true;
+    }
+    runFor = timeout;
+    motorState = travelling;
+    io.startMotor(level);
+    return true;
+}
+
+bool MotorController::busy() const
+{
+    return motorState == MOTOR_NUDGING || motorState == MOTOR_OPENING || motorState == MOTOR_CLOSING;
+}
+
+void MotorController::finish(MotorState next)
+{
+    io.stopMotor();
+    lastTravel = io.now() - startedAt;
+    motorState = next;
+}
+
+bool MotorController::tick()
+{
+    if (!busy())
+    {
+        return false;
+    }
+
+    if (motorState != MOTOR_NUDGING && !io.motorRunning())
+    {
+        finish(arrivedState);
+    }
+    else if (io.now() - startedAt >= runFor)
+    {
+        finish(motorState == MOTOR_NUDGING ? MOTOR_IDLE : MOTOR_FAULT);
+    }
+    return busy();
+}
@@ -0,0 +1,66 @@
+#ifndef MOTOR_CONTROLLER_H
+#define MOTOR_CONTROLLER_H
+
+#include <stdint.h>
+
+// Pin access for MotorController, so the controller can run against fake
+// GPIO as well as the real pins
+class MotorIo
+{
+public:
+    virtual ~MotorIo() {}
+    virtual int readSwitch() = 0;            // debounced switch level
+    virtual void startMotor(int stopAt) = 0; // stopAt: switch level that cuts the motor, or MOTOR_NO_SWITCH
+    virtual void stopMotor() = 0;
+    virtual bool motorRunning() = 0; // false once the switch has cut the motor
+    virtual unsigned long now() = 0; // ms
+};
+
+const int MOTOR_NO_SWITCH = -1;
+
+enum MotorState : uint8_t
+{
+    MOTOR_IDLE,    // position unknown
+    MOTOR_NUDGING, // running for a fixed time, switch ignored
+    MOTOR_OPENING,
+    MOTOR_CLOSING,
+    MOTOR_OPEN,
+    MOTOR_CLOSED,
+    MOTOR_FAULT, // travel timed out before the switch was reached
+};
+
+// Valve motor as a state machine. open(), close() and nudge() only start the
+// motor; tick() moves the state on and must be called until it returns false.
+// Nothing here blocks or touches the network.
+class MotorController
+{
+public:
+    MotorController(MotorIo &io, unsigned long timeout, int openLevel);
+
+    bool open();  // false if the motor is already busy
+    bool close(); // to the rest position
+    bool nudge(unsigned long ms);
+    bool tick(); // true while the motor is still busy
+    void setTimeout(unsigned long ms) { timeout = ms; } // for travels started after this
+
+    MotorState state() const { return motorState; }
+    bool busy() const;
+    int targetLevel() const { return target; }
+    unsigned long travelTime() const { return lastTravel; } // ms the last travel took
+
+private:
+    bool start(int level, MotorState travelling, MotorState arrived);
+    void finish(MotorState next);
+
+    MotorIo &io;
+    unsigned long timeout;
+    int openLevel;
+    MotorState motorState = MOTOR_IDLE;
+    MotorState arrivedState = MOTOR_IDLE;
+    int target = MOTOR_NO_SWITCH;
+    unsigned long startedAt = 0;
+    unsigned long runFor = 0;
+    unsigned long lastTravel = 0;
+};
+
+#endif
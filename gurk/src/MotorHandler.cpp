@@ -1,93 +1,409 @@
 #include "MotorHandler.h"
+#include "Energy.h"
+#include "Debounce.h"
+#include "MotorController.h"
+#include "ValveHealth.h"
+#include "FlowMeter.h"
 
 extern const int pinMotor;
 extern const int pinInput;
-extern const char *set_is_watering_rul;
+
+const unsigned long FLOW_POLL_MS = 100; // volume target checks while watering
+
+// Steps of the watering cycle. The current step and its deadlines are
+// checkpointed in RTC memory before every transition, so a deep sleep (or
+// the chunked wakes of one) picks the cycle up where it left off.
+enum WateringState : uint8_t
+{
+    WATERING_IDLE,
+    WATERING_WAITING,   // until the deadline to open
+    WATERING_SYNCING,   // woken ahead of the deadline to take it from the server again
+    WATERING_OPENING,   // driving to the open switch
+    WATERING_WATERING,  // until the volume target or the deadline to close
+    WATERING_CLOSING,   // driving back to the rest switch
+    WATERING_REPORTING, // queueing the closed and volume events
+};
+
+struct WateringCheckpoint
+{
+    uint64_t deadline;     // clockNow() ms to open, then to close at the latest
+    uint32_t durationMs;   // how long the valve stays open, a cap in volume mode
+    uint32_t epoch;        // clockEpoch() the deadlines belong to
+    uint32_t targetMl;     // volume to deliver, 0 for time mode
+    uint32_t deliveredMl;  // measured by the flow meter
+    uint8_t state;
+    uint8_t atEndStop;     // the valve last stopped at a switch, so the next travel is a full one
+    uint8_t reserved[2];
+};
+
+static_assert(rtcBlocks(sizeof(WateringCheckpoint)) <= RTC_SLOT_ENERGY - RTC_SLOT_WATERING, "Watering checkpoint outgrew its RTC slot");
+
+// Where the last move left the valve, so a wake from deep sleep can trust it
+// instead of homing the valve again
+struct ValvePosition
+{
+    uint8_t atRest;    // the switch read the rest level and the motor did not fault
+    uint8_t atEndStop; // stopped by the rest switch, so the next travel is a full one
+    uint8_t reserved[2];
+};
+
+static_assert(rtcBlocks(sizeof(ValvePosition)) <= RTC_SLOT_END - RTC_SLOT_VALVE, "Valve position outgrew its RTC slot");
+
+static bool valveAtEndStop = false;
+static uint8_t valveOpenSamples = 0;
+static bool valveDisplaced = false;
+
+// Polled every millisecond while the schedule request is in flight. Wakes
+// from deep sleep trust the valve to be where it was left, so this is where
+// one that has moved since is caught, for the price of reading a pin. It
+// takes switchDebounceSamples open readings in a row.
+void watchValve()
+{
+    valveOpenSamples = digitalRead(pinInput) == HIGH ? 0 : min(valveOpenSamples + 1, 255);
+    if (valveOpenSamples >= switchDebounceSamples)
+    {
+        valveDisplaced = true;
+    }
+}
+
+bool takeValveDisplaced()
+{
+    bool displaced = valveDisplaced;
+    valveDisplaced = false;
+    valveOpenSamples = 0;
+    return displaced;
+}
 
 void sendWateringStatus(boolean status)
 {
-    if (WiFi.status() == WL_CONNECTED)
+    // Goes out with the next event upload, see disconnectFromWiFi()
+    queueEvent(EVENT_WATERING, status);
+}
+
+// End of travel, set from the switch sampling interrupt
+static volatile int travelTarget = MOTOR_NO_SWITCH;
+static volatile bool travelDone = false;
+static volatile uint32_t switchEdgeAt = 0; // micros() the switch started to arrive
+static volatile uint32_t motorOffAt = 0;   // micros() the interrupt cut the motor
+
+// Cuts the motor on the first clean edge to the wanted level, without
+// waiting for the loop to notice
+static void IRAM_ATTR onLimitSwitch(const SwitchEdge &edge)
+{
+    if (travelDone || edge.level != travelTarget)
     {
-        WiFiClient client;
-        HTTPClient http;
-        http.begin(client, set_is_watering_rul);
-        http.addHeader("Content-Type", "application/json");
+        return;
+    }
+    digitalWrite(pinMotor, LOW);
+    motorOffAt = micros();
+    switchEdgeAt = edge.at;
+    travelDone = true;
+    esp_schedule();
+}
 
-        StaticJsonDocument<200> doc;
-        doc["isWatering"] = status;
+// The real pins: pinMotor, and pinInput through the debounced timer sampling
+class GpioMotorIo : public MotorIo
+{
+public:
+    int readSwitch() override
+    {
+        return ::readSwitch(pinInput);
+    }
 
-        String payload;
-        serializeJson(doc, payload);
+    void startMotor(int stopAt) override
+    {
+        travelTarget = stopAt;
+        travelDone = false;
+        if (stopAt != MOTOR_NO_SWITCH)
+        {
+            switchBegin(pinInput, onLimitSwitch);
+        }
+        digitalWrite(pinMotor, HIGH);
+        powerOn(LOAD_MOTOR);
+    }
 
-        int httpCode = http.POST(payload);
-        if (httpCode > 0)
+    void stopMotor() override
+    {
+        if (travelTarget != MOTOR_NO_SWITCH)
         {
-            String response = http.getString();
-            Serial.println(httpCode);
-            Serial.println(response);
+            switchEnd();
         }
-        else
+        digitalWrite(pinMotor, LOW); // a no-op unless the switch was never reached
+        powerOff(LOAD_MOTOR);
+        if (travelDone)
         {
-            Serial.print("Error on HTTP request: ");
-            Serial.println(http.errorToString(httpCode).c_str());
+            Serial.printf("Switch to motor off %lu us, %u bounces filtered\n",
+                          (unsigned long)(motorOffAt - switchEdgeAt), switchBounces());
         }
-        http.end();
     }
-    else
+
+    bool motorRunning() override
     {
-        Serial.println("WiFi Disconnected");
+        return !travelDone;
     }
+
+    unsigned long now() override
+    {
+        return millis();
+    }
+};
+
+static GpioMotorIo gpioMotorIo;
+static MotorController motor(gpioMotorIo, maxOnDuration, LOW);
+
+static void saveValvePosition()
+{
+    ValvePosition position = {};
+    position.atRest = motor.state() != MOTOR_FAULT && readSwitch(pinInput) == HIGH;
+    position.atEndStop = motor.state() == MOTOR_CLOSED;
+    valveAtEndStop = position.atEndStop;
+    rtcSave(RTC_SLOT_VALVE, &position, sizeof(position));
 }
 
-void handleMotor(int time_until_watering, int maxOnDuration, const char *noButtonSignalUrl, const char *ssid, const char *password, int waitState)
+// Sleeps until the motor is done, woken early by the switch interrupt
+static void waitForMotor()
 {
-    // Turn on the Motor
-    digitalWrite(pinMotor, HIGH);
-    disconnectFromWiFi();
-    unsigned long startTime = millis();
-    bool ButtonSignal = false;
+    while (motor.tick())
+    {
+        esp_delay(10, []()
+                  { return !travelDone; });
+    }
+}
 
-    while (millis() - startTime < maxOnDuration)
+// Drives the valve open or back to rest and waits for it. Only full travels,
+// from one switch to the other, teach ValveHealth and are held to the timeout
+// it has learned; from anywhere else the motor gets maxOnDuration. Queues an
+// event when the switch is never reached
+static void moveValve(bool opening, bool fromEndStop)
+{
+    motor.setTimeout(fromEndStop ? travelTimeout(opening) : maxOnDuration);
+    opening ? motor.open() : motor.close();
+    waitForMotor();
+    saveValvePosition();
+    if (motor.state() == MOTOR_FAULT)
+    {
+        queueEvent(EVENT_NO_BUTTON_SIGNAL, motor.targetLevel());
+        shutdown("No button signal received, shutting down");
+        return;
+    }
+    if (fromEndStop && motor.travelTime() > 0)
     {
-        // Read the button state directly without debouncing
-        int buttonState = digitalRead(pinInput);
+        recordTravel(opening, motor.travelTime());
+    }
+}
+
+static void saveCheckpoint(WateringCheckpoint &cp, WateringState state)
+{
+    cp.state = state;
+    rtcSave(RTC_SLOT_WATERING, &cp, sizeof(cp));
+}
+
+static void radioOffForMotor()
+{
+    if (WiFi.status() == WL_CONNECTED)
+    {
+        disconnectFromWiFi();
+    }
+}
+
+// Returns once the deadline has passed, in light sleep for short waits.
+// Waits long enough to pay for a reboot are slept in deep sleep instead, and
+// then this does not return; the cycle carries on from its checkpoint after
+// the wake.
+static void waitUntil(uint64_t deadline)
+{
+    uint64_t now = clockNow();
+    if (deadline <= now)
+    {
+        return;
+    }
 
-        // Check if the button state matches the wait state
-        if (buttonState == waitState)
+    uint64_t remaining = deadline - now;
+    if (remaining < DEEP_SLEEP_MIN_WAIT)
+    {
+        radioOffForMotor();
+        // Wake early if the valve leaves the position it is resting in
+        int level = digitalRead(pinInput);
+        while (lightSleepUntil(deadline, pinInput, level == HIGH ? LOW : HIGH))
         {
-            ButtonSignal = true;
-            break;
+            level = digitalRead(pinInput);
+            Serial.printf("Valve switch changed to %d while waiting\n", level);
         }
-
-        delay(10); // Small delay to prevent high CPU usage
+        return;
     }
+    radioOffForMotor();
+    Serial.printf("Watering: deep sleeping %lu s\n", (unsigned long)(remaining / 1000));
+    sleepUntil(deadline);
+}
 
-    // Turn off the Motor
-    digitalWrite(pinMotor, LOW);
-    connectToWiFi(ssid, password);
+// How far ahead of the deadline to wake from a deep sleep of sleepMs, so
+// the schedule can be fetched once more and the valve still open on time
+static uint64_t syncLead(uint64_t sleepMs)
+{
+    return predictedWakeLatency(wakeLatencyPercentile) + wakeMarginMs(sleepMs);
+}
 
-    // If no button signal received, perform shutdown
-    if (!ButtonSignal)
+// Waits for the deadline to open. A long wait is deep slept only up to
+// syncLead() before the deadline, so drift over the sleep does not land on
+// the opening; the wake fetches the schedule in WATERING_SYNCING and comes
+// back here for the short rest. Does not return when it deep sleeps.
+static void waitToOpen(WateringCheckpoint &cp)
+{
+    uint64_t now = clockNow();
+    uint64_t remaining = cp.deadline > now ? cp.deadline - now : 0;
+    uint64_t lead = syncLead(remaining);
+    if (remaining > lead + DEEP_SLEEP_MIN_WAIT)
     {
-        sendRequestToServer(noButtonSignalUrl);
-        shutdown("No button signal received, shutting down");
+        saveCheckpoint(cp, WATERING_SYNCING);
+        radioOffForMotor();
+        Serial.printf("Watering: deep sleeping %lu s, waking %lu ms early to sync\n",
+                      (unsigned long)((remaining - lead) / 1000), (unsigned long)lead);
+        sleepUntil(cp.deadline - lead);
     }
+    waitUntil(cp.deadline);
 }
 
-void processResponse(const String &payload)
+// Fetches the schedule again and takes the deadline from it. The Date header
+// of the same response pulls the clock onto server time, which also puts a
+// deadline answered from the ETag cache right. Keeps the old deadline if the
+// server can't be reached, and drops the cycle if the watering has moved
+// past the next poll.
+static void syncDeadline(WateringCheckpoint &cp)
 {
-    StaticJsonDocument<200> doc;
-    DeserializationError error = deserializeJson(doc, payload);
-    if (error)
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        WiFi.persistent(false);
+        connectToWiFi(ssid, password);
+    }
+
+    DeviceVariables vars;
+    if (!fetchDeviceVariables(serverUrl, vars))
+    {
+        Serial.println("Watering: schedule sync failed, keeping the deadline");
+        disconnectFromWiFi(false);
+        saveCheckpoint(cp, WATERING_WAITING);
+        return;
+    }
+    if (vars.time_until_watering >= vars.sleep_time)
     {
-        Serial.print("deserializeJson() failed: ");
-        Serial.println(error.f_str());
+        Serial.println("Watering: no longer due before the next poll, dropping the cycle");
+        rtcClear(RTC_SLOT_WATERING);
+        cp.state = WATERING_IDLE;
         return;
     }
 
-    int time_until_watering = 1000 * int(doc["time_until_watering"]);
-    unsigned long watering_time = doc["watering_time"] * 1000 * 60; // Access the value as an integer
-    int sleep_time = doc["sleep_time"] * 1000;
+    uint64_t deadline = clockNow() + 1000ULL * max(vars.time_until_watering, (int32_t)0);
+    Serial.printf("Watering: sync moved the deadline by %ld ms\n", (long)((int64_t)deadline - (int64_t)cp.deadline));
+    cp.deadline = deadline;
+    saveCheckpoint(cp, WATERING_WAITING);
+}
+
+// Stays awake counting flow pulses, which deep sleep would miss, until the
+// volume target is met or the time runs out
+static void waitForWater(WateringCheckpoint &cp)
+{
+    flowBegin(); // no-op unless resumed after a reset
+    while (clockNow() < cp.deadline && (cp.targetMl == 0 || flowMillilitres() < cp.targetMl))
+    {
+        delay(min(cp.deadline - clockNow(), (uint64_t)FLOW_POLL_MS));
+    }
+    cp.deliveredMl = flowMillilitres();
+    Serial.printf("Watering: %lu ml delivered%s\n", (unsigned long)cp.deliveredMl,
+                  cp.targetMl > 0 && cp.deliveredMl < cp.targetMl ? ", time cap reached before the target" : "");
+}
+
+static void runWateringCycle(WateringCheckpoint &cp)
+{
+    while (cp.state != WATERING_IDLE)
+    {
+        switch (cp.state)
+        {
+        case WATERING_WAITING:
+            waitToOpen(cp);
+            saveCheckpoint(cp, WATERING_OPENING);
+            break;
+        case WATERING_SYNCING:
+            syncDeadline(cp);
+            break;
+        case WATERING_OPENING:
+            radioOffForMotor();
+            flowBegin();
+            moveValve(true, cp.atEndStop);
+            cp.atEndStop = motor.state() == MOTOR_OPEN;
+            sendWateringStatus(true);
+            cp.deadline = clockNow() + cp.durationMs;
+            saveCheckpoint(cp, WATERING_WATERING);
+            break;
+        case WATERING_WATERING:
+            if (flowMeterFitted())
+            {
+                waitForWater(cp);
+            }
+            else
+            {
+                waitUntil(cp.deadline);
+            }
+            saveCheckpoint(cp, WATERING_CLOSING);
+            break;
+        case WATERING_CLOSING:
+            radioOffForMotor();
+            moveValve(false, cp.atEndStop);
+            if (flowMeterFitted())
+            {
+                // The last of the flow while the valve closes
+                cp.deliveredMl = flowMillilitres();
+                flowEnd();
+            }
+            saveCheckpoint(cp, WATERING_REPORTING);
+            break;
+        case WATERING_REPORTING:
+            sendWateringStatus(false);
+            if (flowMeterFitted())
+            {
+                queueEvent(EVENT_WATER_VOLUME, min(cp.deliveredMl / 100, (uint32_t)INT16_MAX));
+            }
+            rtcClear(RTC_SLOT_WATERING);
+            cp.state = WATERING_IDLE;
+            break;
+        default:
+            rtcClear(RTC_SLOT_WATERING);
+            cp.state = WATERING_IDLE;
+            break;
+        }
+    }
+}
+
+bool resumeWatering()
+{
+    WateringCheckpoint cp;
+    if (!rtcLoad(RTC_SLOT_WATERING, &cp, sizeof(cp)))
+    {
+        return false;
+    }
+
+    if (cp.epoch != clockEpoch())
+    {
+        // The clock lost continuity, so the deadlines mean nothing. Homing in
+        // setup() brings the valve back to rest.
+        Serial.println("Watering checkpoint is from before a reset, dropping it");
+        if (cp.state >= WATERING_WATERING && cp.state <= WATERING_CLOSING)
+        {
+            sendWateringStatus(false);
+        }
+        rtcClear(RTC_SLOT_WATERING);
+        return false;
+    }
+
+    Serial.printf("Resuming watering cycle at step %u\n", cp.state);
+    runWateringCycle(cp);
+    return true;
+}
+
+void processResponse(const DeviceVariables &vars)
+{
+    int time_until_watering = 1000 * vars.time_until_watering;
+    unsigned long watering_time = vars.watering_time * 1000 * 60;
+    int sleep_time = vars.sleep_time * 1000;
     Serial.print("time_until_watering after JSON parsing = ");
     Serial.println(time_until_watering);
     Serial.print("Motor On Duration = ");
@@ -95,49 +411,65 @@ void processResponse(const String &payload)
     Serial.print("Sleep Time = ");
     Serial.println(sleep_time);
 
-    if (time_until_watering < sleep_time + 20000) // 4 timmar + 15 sekunder
-    {                                             // är här inne om mindre än sleep_time tid tills vattning
-        if (time_until_watering > 0)              // om tiden är mer än 0, alltså vi ska vänta
+    // The next poll is ready about a wake-to-ready latency after the sleep
+    // ends. Start the cycle now unless that would still be in time, so the
+    // valve opens within wateringTolerance of the schedule.
+    long lead = predictedWakeLatency(wakeLatencyPercentile) + wakeMarginMs(sleep_time);
+    lead = max(lead - (long)wateringTolerance, 0L);
+    Serial.printf("Pre-wake lead: %ld ms\n", lead);
+
+    if (time_until_watering < sleep_time + lead) // 4 timmar + förväntad uppstartstid
+    {                                            // är här inne om mindre än sleep_time tid tills vattning
+        WateringCheckpoint cp = {};
+        cp.deadline = clockNow() + max(time_until_watering, 0);
+        cp.durationMs = watering_time;
+        if (vars.watering_volume > 0 && flowMeterFitted())
+        {
+            cp.targetMl = vars.watering_volume * 1000;
+            Serial.printf("Volume target %lu ml, at most %lu ms\n", (unsigned long)cp.targetMl, watering_time);
+        }
+        cp.epoch = clockEpoch();
+        cp.atEndStop = valveAtEndStop;
+        saveCheckpoint(cp, WATERING_WAITING);
+        runWateringCycle(cp);
+        if (WiFi.status() != WL_CONNECTED)
         {
-            disconnectFromWiFi();
-            Serial.printf("Sleeping for %d ms before doing a cycle\n", time_until_watering);
-            delay(time_until_watering);
             connectToWiFi(ssid, password);
         }
-
-        handleMotor(time_until_watering, maxOnDuration, noButtonSignalUrl, ssid, password, LOW);
-        sendWateringStatus(true);
-        disconnectFromWiFi();
-        delay(watering_time);
-        connectToWiFi(ssid, password);
-        handleMotor(time_until_watering, maxOnDuration, noButtonSignalUrl, ssid, password, HIGH);
-        sendWateringStatus(false);
     }
     else // om mer än wait threshhold, sov o kolla igen om sleep_time tid
     {
         disconnectFromWiFi();
         Serial.printf("Sleeping for %d ms\n", sleep_time);
-        delay(sleep_time); // Sleep for the threshold time
-        connectToWiFi(ssid, password);
+        go_to_sleep(sleep_time); // setup() starts the wake-to-ready timer when it ends
     }
 }
 
+// Frees the valve with a short run, then drives it back to rest if that
+// left it open
 void resetMotor()
 {
-    digitalWrite(pinMotor, HIGH);
-    delay(5000);
-    digitalWrite(pinMotor, LOW);
-    if (digitalRead(pinInput) == HIGH)
+    motor.nudge(5000);
+    waitForMotor();
+
+    if (readSwitch(pinInput) == LOW)
+    {
+        moveValve(false, false);
+    }
+    else
     {
-        handleMotor(0, maxOnDuration, noButtonSignalUrl, ssid, password, HIGH);
+        saveValvePosition();
     }
+}
 
-    if (digitalRead(pinInput) == LOW)
+bool valveLeftAtRest()
+{
+    ValvePosition position;
+    if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE ||
+        !rtcLoad(RTC_SLOT_VALVE, &position, sizeof(position)) || !position.atRest)
     {
-        handleMotor(0, maxOnDuration, noButtonSignalUrl, ssid, password, HIGH);
-        if (digitalRead(pinInput) == HIGH)
-        {
-            handleMotor(0, maxOnDuration, noButtonSignalUrl, ssid, password, LOW);
-        }
+        return false;
     }
+    valveAtEndStop = position.atEndStop;
+    return true;
 }
\ No newline at end of file
@@ -9,12 +9,21 @@
 #include "Config.h"
 #include "../lib/ArduinoJson-v6.21.5.h"
 #include "Utils.h"
+#include "EventQueue.h"
 #include <ESP8266WiFi.h>
 #include <ESP8266HTTPClient.h>
 
-void handleMotor(int time_until_watering, int maxOnDuration, const char *noButtonSignalUrl, const char *ssid, const char *password, int waitState);
 
-void processResponse(const String &payload);
+void processResponse(const DeviceVariables &vars);
+bool resumeWatering(); // finishes a cycle checkpointed before deep sleep, true if there was one
 void resetMotor();
+// True on a wake from deep sleep when the valve was left at rest, so it
+// needs no homing
+bool valveLeftAtRest();
+// Watches the valve switch while a request is in flight (pass to
+// fetchDeviceVariables()); takeValveDisplaced() then says whether the valve
+// was seen away from rest
+void watchValve();
+bool takeValveDisplaced();
 
 #endif // MOTOR_HANDLER_H
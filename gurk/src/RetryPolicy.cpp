@@ -0,0 +1,65 @@
+#include "RetryPolicy.h"
+
+const unsigned long RETRY_MAX_DELAY = 3600000;   // 1 hour
+const uint8_t RETRY_WAKE_ATTEMPTS = 3;           // failed attempts per wake
+const unsigned long RETRY_WAKE_RADIO_MS = 60000; // 1 minute of radio-on time per wake
+
+struct RetryState
+{
+    uint16_t failures;
+    uint16_t reserved;
+};
+
+static_assert(rtcBlocks(sizeof(RetryState)) <= RTC_SLOT_TIMINGS - RTC_SLOT_RETRY, "Retry state outgrew its RTC slot");
+
+static RetryState retryState;
+static bool retryLoaded = false;
+static uint8_t wakeAttempts = 0;
+
+static void loadRetryState()
+{
+    if (!retryLoaded && !rtcLoad(RTC_SLOT_RETRY, &retryState, sizeof(retryState)))
+    {
+        retryState.failures = 0;
+    }
+    retryLoaded = true;
+}
+
+void retrySucceeded()
+{
+    loadRetryState();
+    if (retryState.failures > 0)
+    {
+        Serial.printf("Server reachable again after %u failures\n", retryState.failures);
+        retryState.failures = 0;
+        rtcSave(RTC_SLOT_RETRY, &retryState, sizeof(retryState));
+    }
+}
+
+unsigned long retryFailed()
+{
+    loadRetryState();
+    if (retryState.failures < 0xFFFF)
+    {
+        retryState.failures++;
+    }
+    wakeAttempts++;
+    rtcSave(RTC_SLOT_RETRY, &retryState, sizeof(retryState));
+
+    // Equal jitter: half the back-off is fixed, the other half random
+    unsigned long backoff = RETRY_MAX_DELAY;
+    if (retryState.failures <= 16 && ((unsigned long)errorTimeout << (retryState.failures - 1)) < RETRY_MAX_DELAY)
+    {
+        backoff = (unsigned long)errorTimeout << (retryState.failures - 1);
+    }
+    unsigned long delayMs = backoff / 2 + ESP.random() % (backoff / 2 + 1);
+
+    Serial.printf("Request failed %u times, retrying in %lu ms (attempt %u this wake, radio on %lu ms)\n",
+                  retryState.failures, delayMs, wakeAttempts, radioOnTime());
+    return delayMs;
+}
+
+bool retryBudgetSpent()
+{
+    return wakeAttempts >= RETRY_WAKE_ATTEMPTS || radioOnTime() >= RETRY_WAKE_RADIO_MS;
+}
@@ -0,0 +1,19 @@
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <Arduino.h>
+#include "RtcMemory.h"
+#include "WiFiManager.h"
+#include "Config.h"
+
+// Back-off for failed server requests. The delay grows exponentially from
+// errorTimeout up to a cap, with jitter so a fleet recovering from the same
+// outage doesn't come back in lockstep. The failure count lives in RTC
+// memory so it keeps growing across deep sleep. Each wake also has a budget
+// of attempts and radio-on time; once it is spent the rest of the wait is
+// done in deep sleep, as is any wait of DEEP_SLEEP_MIN_WAIT or more.
+void retrySucceeded();
+unsigned long retryFailed(); // returns the delay before the next attempt, in ms
+bool retryBudgetSpent();
+
+#endif
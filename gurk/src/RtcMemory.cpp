@@ -0,0 +1,39 @@
+#include "RtcMemory.h"
+
+bool rtcLoad(uint32_t slot, void *data, size_t size)
+{
+    uint32_t buffer[RTC_MAX_RECORD / 4 + 1];
+    size_t blocks = rtcBlocks(size);
+    if (size > RTC_MAX_RECORD || !ESP.rtcUserMemoryRead(slot, buffer, blocks * 4))
+    {
+        return false;
+    }
+
+    if (crc32(&buffer[1], size) != buffer[0])
+    {
+        return false;
+    }
+
+    memcpy(data, &buffer[1], size);
+    return true;
+}
+
+bool rtcSave(uint32_t slot, const void *data, size_t size)
+{
+    uint32_t buffer[RTC_MAX_RECORD / 4 + 1] = {0};
+    size_t blocks = rtcBlocks(size);
+    if (size > RTC_MAX_RECORD)
+    {
+        return false;
+    }
+
+    memcpy(&buffer[1], data, size);
+    buffer[0] = crc32(&buffer[1], size);
+    return ESP.rtcUserMemoryWrite(slot, buffer, blocks * 4);
+}
+
+void rtcClear(uint32_t slot)
+{
+    uint32_t zero = 0;
+    ESP.rtcUserMemoryWrite(slot, &zero, sizeof(zero));
+}
@@ -0,0 +1,46 @@
+#ifndef RTC_MEMORY_H
+#define RTC_MEMORY_H
+
+#include <Arduino.h>
+
+// RTC user memory keeps its contents through deep sleep (but not through a
+// power cycle). It is 512 bytes, addressed in 4 byte blocks. Each record is
+// stored behind a CRC32 so garbage after power-on is never trusted.
+const uint32_t RTC_USER_BLOCKS = 128;
+
+// Blocks a record of size bytes takes, CRC included
+constexpr uint32_t rtcBlocks(size_t size)
+{
+    return (size + 3) / 4 + 1;
+}
+
+// Slot offsets are in blocks, each slot following the one before it. Where a
+// record is defined, a static_assert checks it fits the space up to the next
+// slot; mind the padding structs with a uint64_t get up to a multiple of 8.
+enum RtcSlot : uint32_t
+{
+    RTC_SLOT_WIFI = 0,                           // WiFiManager lease, 7 blocks
+    RTC_SLOT_TLS = RTC_SLOT_WIFI + 7,            // HTTPHandler TLS session, 24 blocks
+    RTC_SLOT_CLOCK = RTC_SLOT_TLS + 24,          // Utils wake clock, 5 blocks
+    RTC_SLOT_VARIABLES = RTC_SLOT_CLOCK + 5,     // HTTPHandler cached device variables and ETag, 13 blocks
+    RTC_SLOT_EVENTS = RTC_SLOT_VARIABLES + 13,   // EventQueue, 19 blocks
+    RTC_SLOT_RETRY = RTC_SLOT_EVENTS + 19,       // RetryPolicy, 2 blocks
+    RTC_SLOT_TIMINGS = RTC_SLOT_RETRY + 2,       // WakeTimings, 7 blocks
+    RTC_SLOT_SLEEP = RTC_SLOT_TIMINGS + 7,       // Utils chained deep sleep, 7 blocks
+    RTC_SLOT_WATERING = RTC_SLOT_SLEEP + 7,      // MotorHandler watering cycle checkpoint, 9 blocks
+    RTC_SLOT_ENERGY = RTC_SLOT_WATERING + 9,     // Energy time per power load, 8 blocks
+    RTC_SLOT_DRIFT = RTC_SLOT_ENERGY + 8,        // Utils RTC drift calibration, 9 blocks
+    RTC_SLOT_LATENCY = RTC_SLOT_DRIFT + 9,       // WakeTimings wake-to-ready history, 6 blocks
+    RTC_SLOT_VALVE = RTC_SLOT_LATENCY + 6,       // MotorHandler valve position, 2 blocks
+    RTC_SLOT_END = RTC_SLOT_VALVE + 2,
+};
+
+static_assert(RTC_SLOT_END <= RTC_USER_BLOCKS, "RTC slots overrun RTC user memory");
+
+const size_t RTC_MAX_RECORD = 128; // largest record in bytes, excluding CRC
+
+bool rtcLoad(uint32_t slot, void *data, size_t size);
+bool rtcSave(uint32_t slot, const void *data, size_t size);
+void rtcClear(uint32_t slot);
+
+#endif
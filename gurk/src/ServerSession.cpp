@@ -0,0 +1,555 @@
+#include "ServerSession.h"
+#include "Energy.h"
+
+const uint16_t TLS_PORT = 443;
+const int TLS_DEFAULT_RX_BUFFER = 16384; // what BearSSL allocates when MFLN is not negotiated
+const int TLS_TX_BUFFER = 512;           // our requests are a few hundred bytes
+const uint16_t TLS_FRAGMENT_SIZES[] = {512, 1024};
+const char *ACCEPT_TYPES = "application/msgpack, application/json;q=0.5";
+const unsigned long REQUEST_TIMEOUT = 5000; // 5 seconds from sending the request to the end of the headers
+
+// Key exchanges that are cheap for the client first (RSA only needs a public
+// key operation), then ECDHE with the fastest software ciphers
+static const uint16_t TLS_CIPHERS[] PROGMEM = {
+    BR_TLS_RSA_WITH_AES_128_GCM_SHA256,
+    BR_TLS_RSA_WITH_AES_128_CBC_SHA256,
+    BR_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+    BR_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+    BR_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    BR_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+};
+
+// The BearSSL session plus hit counters, kept in RTC memory so a wake from
+// deep sleep can resume the last TLS session instead of a full handshake.
+// Session keeps its parameters to itself, so the whole object is copied.
+struct TlsSessionCache
+{
+    BearSSL::Session session;
+    uint16_t resumed;
+    uint16_t full;
+    uint16_t maxFragment; // 0 = not probed yet, TLS_DEFAULT_RX_BUFFER = server has no MFLN
+};
+
+static_assert(rtcBlocks(sizeof(TlsSessionCache)) <= RTC_SLOT_CLOCK - RTC_SLOT_TLS, "TLS session cache outgrew its RTC slot");
+
+static BearSSL::Session tlsSession;
+static TlsSessionCache tlsCache;
+static bool tlsCacheLoaded = false;
+
+static void loadTlsSession()
+{
+    if (tlsCacheLoaded)
+    {
+        return;
+    }
+
+    if (rtcLoad(RTC_SLOT_TLS, &tlsCache, sizeof(tlsCache)))
+    {
+        tlsSession = tlsCache.session;
+    }
+    else
+    {
+        tlsCache = TlsSessionCache();
+    }
+    tlsCacheLoaded = true;
+}
+
+static void saveTlsSession()
+{
+    // A resumed handshake keeps the session ID and master secret, a full one
+    // replaces both
+    bool resumed = tlsCache.resumed + tlsCache.full > 0 &&
+                   memcmp(&tlsSession, &tlsCache.session, sizeof(tlsSession)) == 0;
+
+    if (resumed)
+    {
+        tlsCache.resumed++;
+    }
+    else
+    {
+        tlsCache.full++;
+    }
+    tlsCache.session = tlsSession;
+    rtcSave(RTC_SLOT_TLS, &tlsCache, sizeof(tlsCache));
+
+    Serial.printf("TLS %s handshake (resumed %u, full %u)\n", resumed ? "resumed" : "full", tlsCache.resumed, tlsCache.full);
+}
+
+// Copies the host part of an https:// URL into host
+bool urlHost(const char *url, char *host, size_t size)
+{
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    size_t length = strcspn(start, ":/");
+    if (length == 0 || length >= size)
+    {
+        return false;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+    return true;
+}
+
+// Asks the server once for the smallest max fragment length it accepts. The
+// answer is stored with the TLS session so later wakes skip the probe.
+static uint16_t probeFragmentLength(const char *url)
+{
+    if (tlsCache.maxFragment != 0)
+    {
+        return tlsCache.maxFragment;
+    }
+
+    char host[64];
+    if (!urlHost(url, host, sizeof(host)))
+    {
+        return TLS_DEFAULT_RX_BUFFER;
+    }
+
+    tlsCache.maxFragment = TLS_DEFAULT_RX_BUFFER;
+    for (uint16_t length : TLS_FRAGMENT_SIZES)
+    {
+        if (WiFiClientSecure::probeMaxFragmentLength(host, TLS_PORT, length))
+        {
+            tlsCache.maxFragment = length;
+            break;
+        }
+    }
+    Serial.printf("MFLN probe for %s: %u\n", host, tlsCache.maxFragment);
+    return tlsCache.maxFragment;
+}
+
+// Low memory TLS profile: receive buffer sized to the negotiated fragment
+// length, small transmit buffer and a short list of cheap cipher suites
+static int configureTlsClient(WiFiClientSecure &client, const char *url)
+{
+    client.setInsecure(); // Disable SSL certificate verification
+
+    loadTlsSession();
+    client.setSession(&tlsSession);
+
+    int rxBuffer = probeFragmentLength(url);
+    client.setBufferSizes(rxBuffer, TLS_TX_BUFFER);
+    client.setCiphers(TLS_CIPHERS, sizeof(TLS_CIPHERS) / sizeof(TLS_CIPHERS[0]));
+    return rxBuffer;
+}
+
+int BodyStream::available()
+{
+    if (done)
+    {
+        return 0;
+    }
+    int buffered = source->available();
+    return remaining > 0 && buffered > remaining ? remaining : buffered;
+}
+
+int BodyStream::read()
+{
+    if (done || (chunked && remaining == 0 && !nextChunk()))
+    {
+        return -1;
+    }
+    int c = source->read();
+    if (c >= 0 && remaining > 0)
+    {
+        remaining--;
+        done = !chunked && remaining == 0;
+    }
+    return c;
+}
+
+int BodyStream::peek()
+{
+    if (done || (chunked && remaining == 0 && !nextChunk()))
+    {
+        return -1;
+    }
+    return source->peek();
+}
+
+// Reads a chunk header ("1a;ext\r\n"), skipping the CRLF that ends the
+// previous chunk. A zero sized chunk marks the end of the body; the trailer
+// after it is consumed too so the next response starts clean.
+bool BodyStream::nextChunk()
+{
+    long size = 0;
+    bool digits = false;
+    bool extension = false;
+    char c;
+    while (source->readBytes(&c, 1) == 1)
+    {
+        if (c == '\n')
+        {
+            if (digits)
+            {
+                break;
+            }
+            continue;
+        }
+        if (c == ';')
+        {
+            extension = true;
+        }
+        else if (!extension && isxdigit(c))
+        {
+            size = size * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            digits = true;
+        }
+    }
+
+    if (size == 0)
+    {
+        bool emptyLine = true;
+        while (source->readBytes(&c, 1) == 1)
+        {
+            if (c == '\n')
+            {
+                if (emptyLine)
+                {
+                    break;
+                }
+                emptyLine = true;
+            }
+            else if (c != '\r')
+            {
+                emptyLine = false;
+            }
+        }
+        done = true;
+        return false;
+    }
+
+    remaining = size;
+    return true;
+}
+
+ServerSession serverSession;
+
+bool ServerSession::start(const char *method, const char *url, const char *contentType,
+                          const uint8_t *payload, size_t size, const char *ifNoneMatch)
+{
+    if (requestState == REQUEST_CONNECTING || requestState == REQUEST_WAITING || requestState == REQUEST_HEADERS)
+    {
+        return false;
+    }
+    end();
+
+    this->method = method;
+    this->url = url;
+    requestContentType = contentType;
+    this->payload = payload;
+    payloadSize = size;
+    this->ifNoneMatch = ifNoneMatch;
+    startedAt = millis();
+
+    statusCode = 0;
+    contentLength = -1;
+    chunked = false;
+    keepAlive = true;
+    lineLength = 0;
+    etagHeader[0] = '\0';
+    contentTypeHeader[0] = '\0';
+    requestState = REQUEST_CONNECTING;
+    return true;
+}
+
+bool ServerSession::tick()
+{
+    switch (requestState)
+    {
+    case REQUEST_CONNECTING:
+        if (!connect())
+        {
+            fail(HTTPC_ERROR_CONNECTION_FAILED);
+            return false;
+        }
+        if (!sendRequest())
+        {
+            fail(HTTPC_ERROR_SEND_HEADER_FAILED);
+            return false;
+        }
+        requests++;
+        startedAt = millis();
+        sentAt = micros();
+        requestState = REQUEST_WAITING;
+        return true;
+
+    case REQUEST_WAITING:
+    case REQUEST_HEADERS:
+        readHeaders();
+        if (requestState == REQUEST_DONE)
+        {
+            return false;
+        }
+        if (!client.connected() && client.available() == 0)
+        {
+            fail(HTTPC_ERROR_CONNECTION_LOST);
+            return false;
+        }
+        if (millis() - startedAt > REQUEST_TIMEOUT)
+        {
+            fail(HTTPC_ERROR_READ_TIMEOUT);
+            return false;
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+int ServerSession::wait(void (*whileWaiting)())
+{
+    while (tick())
+    {
+        if (whileWaiting)
+        {
+            whileWaiting();
+        }
+        delay(1); // Lets the network stack run
+    }
+    return statusCode;
+}
+
+int ServerSession::post(const char *url, const char *contentType, const uint8_t *body, size_t size)
+{
+    start("POST", url, contentType, body, size);
+    return wait();
+}
+
+void ServerSession::end()
+{
+    if (requestState == REQUEST_DONE)
+    {
+        // Read whatever the caller left of the body so the next response
+        // starts at its status line
+        char c;
+        while (!bodyStream.finished() && bodyStream.readBytes(&c, 1) == 1)
+        {
+        }
+        if (!keepAlive || !bodyStream.finished())
+        {
+            client.stop();
+        }
+    }
+    requestState = REQUEST_IDLE;
+}
+
+void ServerSession::close()
+{
+    if (requests > 0)
+    {
+        Serial.printf("Server session: %u requests over %u connections\n", requests, connects);
+    }
+    client.stop();
+    requestState = REQUEST_IDLE;
+    requests = 0;
+    connects = 0;
+}
+
+bool ServerSession::connect()
+{
+    if (client.connected())
+    {
+        return true;
+    }
+
+    if (!configured)
+    {
+        rxBuffer = configureTlsClient(client, url);
+        configured = true;
+    }
+
+    // BearSSL only sends SNI when it resolves the name itself, and the
+    // Render front end needs SNI, so the connect has to be by name. Looking
+    // the name up first only times the DNS phase; the answer stays in lwIP
+    // for the connect that follows.
+    char host[64];
+    IPAddress address;
+    uint32_t phaseStart = micros();
+    if (!urlHost(url, host, sizeof(host)) || !WiFi.hostByName(host, address))
+    {
+        return false;
+    }
+    recordPhase(PHASE_DNS, micros() - phaseStart);
+
+    uint32_t heapBefore = ESP.getFreeHeap();
+    phaseStart = micros();
+    powerOn(LOAD_TX);
+    bool connected = client.connect(host, TLS_PORT);
+    powerOff(LOAD_TX);
+    if (!connected)
+    {
+        return false;
+    }
+    recordPhase(PHASE_TLS, micros() - phaseStart);
+
+    // The connection and its buffers are all allocated at this point
+    uint32_t heapUsed = heapBefore - ESP.getFreeHeap();
+    Serial.printf("TLS rx %d tx %d, peak heap %u bytes, %d bytes saved over default buffers\n",
+                  rxBuffer, TLS_TX_BUFFER, heapUsed, TLS_DEFAULT_RX_BUFFER - rxBuffer);
+    saveTlsSession();
+    connects++;
+    return true;
+}
+
+bool ServerSession::sendRequest()
+{
+    char host[64];
+    if (!urlHost(url, host, sizeof(host)))
+    {
+        return false;
+    }
+    const char *path = strchr(strstr(url, "://") ? strstr(url, "://") + 3 : url, '/');
+
+    // Headers go out in one write so they share a TLS record
+    char head[320];
+    size_t length = snprintf(head, sizeof(head),
+                             "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: gurk\r\nAccept: %s\r\nConnection: keep-alive\r\n",
+                             method, path ? path : "/", host, ACCEPT_TYPES);
+    if (requestContentType && length < sizeof(head))
+    {
+        length += snprintf(head + length, sizeof(head) - length, "Content-Type: %s\r\nContent-Length: %u\r\n",
+                           requestContentType, (unsigned)payloadSize);
+    }
+    if (ifNoneMatch && length < sizeof(head))
+    {
+        length += snprintf(head + length, sizeof(head) - length, "If-None-Match: %s\r\n", ifNoneMatch);
+    }
+    if (length + 2 >= sizeof(head))
+    {
+        return false;
+    }
+    memcpy(head + length, "\r\n", 2);
+    length += 2;
+
+    powerOn(LOAD_TX);
+    bool sent = client.write((const uint8_t *)head, length) == length &&
+                (payloadSize == 0 || client.write(payload, payloadSize) == payloadSize);
+    powerOff(LOAD_TX);
+    return sent;
+}
+
+// Consumes header lines as far as they have arrived, without waiting
+void ServerSession::readHeaders()
+{
+    if (sentAt != 0 && client.available() > 0)
+    {
+        recordPhase(PHASE_FIRST_BYTE, micros() - sentAt);
+        sentAt = 0;
+    }
+
+    while (client.available() > 0 && requestState != REQUEST_DONE)
+    {
+        char c = client.read();
+        if (c != '\n')
+        {
+            if (c != '\r' && lineLength < sizeof(line) - 1)
+            {
+                line[lineLength++] = c;
+            }
+            continue;
+        }
+
+        line[lineLength] = '\0';
+        if (requestState == REQUEST_WAITING)
+        {
+            // "HTTP/1.1 200 OK"; HTTP/1.0 servers close unless told otherwise
+            if (lineLength > 0)
+            {
+                statusCode = atoi(strchr(line, ' ') ? strchr(line, ' ') + 1 : line);
+                keepAlive = strncmp(line, "HTTP/1.0", 8) != 0;
+                requestState = REQUEST_HEADERS;
+            }
+        }
+        else if (lineLength > 0)
+        {
+            parseHeader(line);
+        }
+        else
+        {
+            bool empty = statusCode == HTTP_CODE_NO_CONTENT || statusCode == HTTP_CODE_NOT_MODIFIED;
+            bodyStream.begin(&client, chunked && !empty, empty ? 0 : contentLength);
+            if (!chunked && contentLength < 0)
+            {
+                keepAlive = false; // Body runs until the server closes
+            }
+            requestState = REQUEST_DONE;
+        }
+        lineLength = 0;
+    }
+}
+
+// "Sun, 06 Nov 1994 08:49:37 GMT" to Unix seconds, 0 if it does not parse
+static uint32_t parseHttpDate(const char *value)
+{
+    static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, minute, second;
+    if (sscanf(value, "%*3s, %2d %3s %4d %2d:%2d:%2d", &day, month, &year, &hour, &minute, &second) != 6)
+    {
+        return 0;
+    }
+    const char *found = strstr(MONTHS, month);
+    if (!found || (found - MONTHS) % 3 != 0)
+    {
+        return 0;
+    }
+
+    // Days since 1970-01-01 from the civil date, with March as the first month
+    int m = (found - MONTHS) / 3 + 1;
+    int y = year - (m <= 2);
+    long era = y / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097 + doe - 719468;
+    return days * 86400 + hour * 3600L + minute * 60 + second;
+}
+
+void ServerSession::parseHeader(char *line)
+{
+    char *value = strchr(line, ':');
+    if (!value)
+    {
+        return;
+    }
+    *value++ = '\0';
+    while (*value == ' ')
+    {
+        value++;
+    }
+
+    if (strcasecmp(line, "Content-Length") == 0)
+    {
+        contentLength = atol(value);
+    }
+    else if (strcasecmp(line, "Transfer-Encoding") == 0)
+    {
+        chunked = strncasecmp(value, "chunked", 7) == 0;
+    }
+    else if (strcasecmp(line, "Connection") == 0)
+    {
+        keepAlive = strncasecmp(value, "close", 5) != 0;
+    }
+    else if (strcasecmp(line, "ETag") == 0)
+    {
+        strncpy(etagHeader, strlen(value) < sizeof(etagHeader) ? value : "", sizeof(etagHeader));
+    }
+    else if (strcasecmp(line, "Date") == 0)
+    {
+        clockCalibrate(parseHttpDate(value), clockNow());
+    }
+    else if (strcasecmp(line, "Content-Type") == 0)
+    {
+        strncpy(contentTypeHeader, value, sizeof(contentTypeHeader) - 1);
+        contentTypeHeader[sizeof(contentTypeHeader) - 1] = '\0';
+    }
+}
+
+void ServerSession::fail(int code)
+{
+    statusCode = code;
+    requestState = REQUEST_FAILED;
+    client.stop();
+}
@@ -0,0 +1,117 @@
+#ifndef SERVER_SESSION_H
+#define SERVER_SESSION_H
+
+#include <ESP8266HTTPClient.h>
+#include "RtcMemory.h"
+#include <ESP8266WiFi.h>
+#include "Utils.h"
+#include "WakeTimings.h"
+
+// Read side of an HTTP body. Stops at Content-Length and strips chunked
+// transfer encoding, so ArduinoJson can parse the socket directly and the
+// connection is left clean for the next request.
+class BodyStream : public Stream
+{
+public:
+    void begin(Stream *source, bool chunked, long length)
+    {
+        this->source = source;
+        this->chunked = chunked;
+        remaining = chunked ? 0 : length;
+        done = !chunked && length == 0;
+    }
+
+    bool finished() const { return done; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    bool nextChunk();
+
+    Stream *source = nullptr;
+    bool chunked = false;
+    bool done = true;
+    long remaining = 0; // -1 = until the server closes the connection
+};
+
+enum RequestState : uint8_t
+{
+    REQUEST_IDLE,
+    REQUEST_CONNECTING,
+    REQUEST_WAITING, // request sent, waiting for the status line
+    REQUEST_HEADERS,
+    REQUEST_DONE, // headers parsed, body ready to read
+    REQUEST_FAILED,
+};
+
+// One keep-alive TLS connection to the server for as long as WiFi is up.
+// Every endpoint goes through it so only the first request pays for the
+// TCP connect and TLS handshake.
+//
+// Requests are driven by tick(): start() only queues one, and each tick()
+// does whatever can be done without waiting on the network, so the caller
+// can keep servicing pins while the server answers. Opening the connection
+// is the exception, BearSSL does the handshake in one blocking call.
+// post() is a blocking wrapper for callers with nothing else to do.
+class ServerSession
+{
+public:
+    bool start(const char *method, const char *url, const char *contentType = nullptr,
+               const uint8_t *payload = nullptr, size_t size = 0, const char *ifNoneMatch = nullptr);
+    bool tick(); // true while the request is still in flight
+    RequestState state() const { return requestState; }
+    int status() const { return statusCode; } // HTTP code, or HTTPC_ERROR_* on failure
+
+    int post(const char *url, const char *contentType, const uint8_t *body, size_t size);
+    int wait(void (*whileWaiting)() = nullptr);
+
+    Stream &body() { return bodyStream; }
+    const char *etag() const { return etagHeader; }
+    const char *contentType() const { return contentTypeHeader; }
+    void end();   // Finish the current request but keep the connection
+    void close(); // Drop the connection, e.g. before WiFi goes off
+
+private:
+    bool connect();
+    bool sendRequest();
+    void readHeaders();
+    void parseHeader(char *line);
+    void fail(int code);
+
+    WiFiClientSecure client;
+    BodyStream bodyStream;
+    RequestState requestState = REQUEST_IDLE;
+    bool configured = false;
+    int rxBuffer = 0;
+    uint8_t requests = 0;
+    uint8_t connects = 0;
+
+    // Current request
+    const char *method = nullptr;
+    const char *url = nullptr;
+    const char *requestContentType = nullptr;
+    const uint8_t *payload = nullptr;
+    size_t payloadSize = 0;
+    const char *ifNoneMatch = nullptr;
+    unsigned long startedAt = 0;
+    uint32_t sentAt = 0; // micros() when the request went out, until the first byte is back
+
+    // Current response
+    int statusCode = 0;
+    long contentLength = -1;
+    bool chunked = false;
+    bool keepAlive = true;
+    char line[96];
+    uint8_t lineLength = 0;
+    char etagHeader[24];
+    char contentTypeHeader[32];
+};
+
+extern ServerSession serverSession;
+
+bool urlHost(const char *url, char *host, size_t size);
+
+#endif
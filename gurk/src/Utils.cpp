@@ -1,18 +1,293 @@
 #include "Utils.h"
+#include "Energy.h"
+#include <user_interface.h>
+extern "C"
+{
+#include <gpio.h>
+}
+
+struct RtcClock
+{
+    uint64_t baseMs; // clock value when this boot started
+    uint32_t epoch;
+    uint32_t sleptMs; // deep sleep so far; wraps, only differences are used
+};
+
+static_assert(rtcBlocks(sizeof(RtcClock)) <= RTC_SLOT_VARIABLES - RTC_SLOT_CLOCK, "Clock outgrew its RTC slot");
+
+static RtcClock rtcClock = {0, 0, 0};
+
+// How far the RTC that times deep sleep is off, learned from server time.
+// Hardware sleeps run ppm parts per million longer than asked for, so they
+// are asked for that much less.
+struct ClockDrift
+{
+    uint64_t refClockMs; // clockNow() when refServerS was current
+    uint32_t refServerS; // server time at the reference, Unix seconds
+    uint32_t refSleptMs; // RtcClock::sleptMs at the reference
+    uint32_t epoch;      // clock epoch of the reference
+    int32_t ppm;
+    uint32_t samples;
+};
+
+static_assert(rtcBlocks(sizeof(ClockDrift)) <= RTC_SLOT_LATENCY - RTC_SLOT_DRIFT, "Clock drift outgrew its RTC slot");
+
+static ClockDrift drift = {0, 0, 0, 0, 0, 0};
+
+const uint64_t CALIBRATION_SPAN_MS = 3600000; // an hour of sleep between samples beats the 1 s server resolution
+const int32_t MAX_DRIFT_PPM = 100000;         // anything beyond 10 % is a bad sample
+const uint32_t UNCALIBRATED_MARGIN_MS = 20000;
+const uint32_t CALIBRATED_MARGIN_MS = 5000;
+const uint32_t CALIBRATED_DRIFT_PPM = 500; // what is left after calibration
+
+const uint64_t SLEEP_SLACK_MS = 1000; // waking this close to the deadline counts as on time
+
+const uint32_t LIGHT_SLEEP_MAX_MS = 268000; // wifi_fpm_do_sleep() takes at most 0xFFFFFFF us
+const uint32_t LIGHT_SLEEP_UA = 900;        // modelled draw in forced light sleep
+const uint32_t IDLE_AWAKE_UA = 15000;       // modelled draw idling in delay() with the radio off
+
+static volatile bool lightSleepWoke = false;
+
+// A chained deep sleep in progress, plus the running cost of the wakes in
+// between hardware sleeps since power-on
+struct SleepState
+{
+    uint64_t wakeAt;            // clockNow() deadline of the sleep in progress
+    uint32_t intermediateWakes; // wakes that only went back to sleep
+    uint32_t intermediateMs;    // ms spent awake on those wakes
+    uint8_t pending;            // a sleep is in progress
+    uint8_t chunks;             // hardware sleeps taken by the current one
+    uint8_t last;               // the chunk in progress is the last, with the radio on
+    uint8_t reserved;
+};
+
+static_assert(rtcBlocks(sizeof(SleepState)) <= RTC_SLOT_WATERING - RTC_SLOT_SLEEP, "Sleep state outgrew its RTC slot");
 
 void shutdown(String message)
 {
     Serial.println(message);
 }
 
-void go_to_sleep(int sleepTime)
+void go_to_sleep(uint64_t sleepTime)
 {
-    Serial.printf("sleeptime in here is = %d\n", sleepTime);
-    WiFi.disconnect(true);
-    delay(1);
+    Serial.printf("sleeptime in here is = %lu\n", (unsigned long)sleepTime);
+    sleepUntil(clockNow() + sleepTime);
+}
+
+void clockBegin()
+{
+    bool valid = rtcLoad(RTC_SLOT_CLOCK, &rtcClock, sizeof(rtcClock));
+    if (!valid)
+    {
+        rtcClock.baseMs = 0;
+        rtcClock.epoch = ESP.random();
+    }
+    else if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+    {
+        // Reset without going through clockAdvance(), the time spent is unknown
+        rtcClock.epoch++;
+    }
+    rtcSave(RTC_SLOT_CLOCK, &rtcClock, sizeof(rtcClock));
+
+    // The drift belongs to the chip, so it outlives clock epochs
+    if (!rtcLoad(RTC_SLOT_DRIFT, &drift, sizeof(drift)))
+    {
+        memset(&drift, 0, sizeof(drift));
+    }
+}
+
+uint64_t clockNow()
+{
+    return rtcClock.baseMs + millis();
+}
 
-    // WAKE_RF_DISABLED to keep the WiFi radio disabled when we wake up
-    ESP.deepSleep(1000 * 1000, RF_DEFAULT);
-    Serial.println("HORUNGE");
-    ESP.reset(); // Reset and try again
-}
\ No newline at end of file
+uint32_t clockEpoch()
+{
+    return rtcClock.epoch;
+}
+
+void clockAdvance(uint64_t sleepMs)
+{
+    rtcClock.baseMs += millis() + sleepMs;
+    rtcClock.sleptMs += sleepMs;
+    rtcSave(RTC_SLOT_CLOCK, &rtcClock, sizeof(rtcClock));
+}
+
+static void setDriftReference(uint32_t serverS, uint64_t atMs)
+{
+    drift.refClockMs = atMs;
+    drift.refServerS = serverS;
+    drift.refSleptMs = rtcClock.sleptMs;
+    drift.epoch = rtcClock.epoch;
+    rtcSave(RTC_SLOT_DRIFT, &drift, sizeof(drift));
+}
+
+void clockCalibrate(uint32_t serverS, uint64_t atMs)
+{
+    if (serverS == 0)
+    {
+        return;
+    }
+    if (drift.epoch != rtcClock.epoch || drift.refServerS == 0 || serverS < drift.refServerS)
+    {
+        setDriftReference(serverS, atMs);
+        return;
+    }
+
+    uint64_t elapsedMs = atMs - drift.refClockMs;
+    uint32_t sleptMs = rtcClock.sleptMs - drift.refSleptMs;
+    if (elapsedMs < CALIBRATION_SPAN_MS)
+    {
+        return;
+    }
+    if (sleptMs < CALIBRATION_SPAN_MS / 2)
+    {
+        // Mostly awake time, which runs off the crystal and says nothing
+        // about the RTC
+        setDriftReference(serverS, atMs);
+        return;
+    }
+
+    // Positive when the sleeps ran long, after the correction already applied
+    int64_t errorMs = (int64_t)(serverS - drift.refServerS) * 1000 - (int64_t)elapsedMs;
+    int32_t residualPpm = errorMs * 1000000 / sleptMs;
+    int32_t measuredPpm = constrain(drift.ppm + residualPpm, -MAX_DRIFT_PPM, MAX_DRIFT_PPM);
+    drift.ppm = drift.samples == 0 ? measuredPpm : drift.ppm + (measuredPpm - drift.ppm) / 4;
+    drift.samples++;
+
+    // Put the clock back on server time so pending deadlines land right
+    rtcClock.baseMs += errorMs;
+    rtcSave(RTC_SLOT_CLOCK, &rtcClock, sizeof(rtcClock));
+    setDriftReference(serverS, atMs + errorMs);
+
+    Serial.printf("Clock drift: %ld ppm (off by %ld ms over %lu s of sleep)\n",
+                  (long)drift.ppm, (long)errorMs, (unsigned long)(sleptMs / 1000));
+}
+
+uint32_t wakeMarginMs(uint64_t sleepMs)
+{
+    if (drift.samples == 0)
+    {
+        return UNCALIBRATED_MARGIN_MS;
+    }
+    return CALIBRATED_MARGIN_MS + sleepMs * CALIBRATED_DRIFT_PPM / 1000000;
+}
+
+// Sleeps the next hardware-sized chunk towards the deadline. The chunk is
+// worked out again on every wake, so boot time on the wakes in between does
+// not add up into a late final wake. Only the last chunk, the one that leaves
+// no more than SLEEP_SLACK_MS, brings the radio up. That is decided here and
+// kept in the sleep state, since a wake with the radio off can't bring it up
+// again without another sleep. A chunk is at least 1 ms, as 0 sleeps forever.
+static void sleepNextChunk(SleepState &sleep)
+{
+    uint64_t now = clockNow();
+    uint64_t remainingMs = sleep.wakeAt > now ? sleep.wakeAt - now : 0;
+    uint64_t maxChunkMs = ESP.deepSleepMax() * (1000000 + drift.ppm) / 1000000 / 1000;
+    uint64_t chunkMs = max(min(remainingMs, maxChunkMs), (uint64_t)1);
+    uint64_t afterMs = remainingMs > chunkMs ? remainingMs - chunkMs : 0;
+    bool last = afterMs <= SLEEP_SLACK_MS;
+    sleep.last = last;
+    sleep.chunks++;
+    rtcSave(RTC_SLOT_SLEEP, &sleep, sizeof(sleep));
+    powerAdd(LOAD_DEEP_SLEEP, chunkMs);
+    energySave();
+    clockAdvance(chunkMs);
+
+    Serial.printf("Sleeping %lu s, %lu s left after that\n", (unsigned long)(chunkMs / 1000), (unsigned long)(afterMs / 1000));
+    ESP.deepSleep(chunkMs * 1000 * 1000000 / (1000000 + drift.ppm), last ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+    ESP.reset(); // Not reached; deepSleep() does not return
+}
+
+void sleepUntil(uint64_t deadline)
+{
+    SleepState sleep;
+    if (!rtcLoad(RTC_SLOT_SLEEP, &sleep, sizeof(sleep)))
+    {
+        memset(&sleep, 0, sizeof(sleep));
+    }
+    sleep.wakeAt = deadline;
+    sleep.pending = 1;
+    sleep.chunks = 0;
+
+    WiFi.mode(WIFI_OFF);
+    sleepNextChunk(sleep);
+}
+
+void resumeSleep()
+{
+    SleepState sleep;
+    if (!rtcLoad(RTC_SLOT_SLEEP, &sleep, sizeof(sleep)) || !sleep.pending)
+    {
+        return;
+    }
+
+    // Another kind of reset means someone wants the device awake now
+    if (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE && !sleep.last)
+    {
+        sleep.intermediateWakes++;
+        sleep.intermediateMs += millis();
+        sleepNextChunk(sleep);
+    }
+    sleep.pending = 0;
+    rtcSave(RTC_SLOT_SLEEP, &sleep, sizeof(sleep));
+    Serial.printf("Woke after %u sleeps; %lu intermediate wakes so far, %lu ms awake on them\n",
+                  sleep.chunks, (unsigned long)sleep.intermediateWakes, (unsigned long)sleep.intermediateMs);
+}
+
+// One forced light sleep of up to ms. Returns the ms actually slept as
+// counted by the RTC timer, which keeps running while the CPU clock is
+// stopped.
+static uint32_t lightSleepChunk(uint32_t ms, int pin, int wakeLevel)
+{
+    uint32_t cali = system_rtc_clock_cali_proc();
+    uint32_t rtcStart = system_get_rtc_time();
+    unsigned long millisStart = millis();
+
+    lightSleepWoke = false;
+    wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+    wifi_fpm_open();
+    gpio_pin_wakeup_enable(GPIO_ID_PIN(pin), wakeLevel == LOW ? GPIO_PIN_INTR_LOLEVEL : GPIO_PIN_INTR_HILEVEL);
+    wifi_fpm_set_wakeup_cb([]()
+                           { lightSleepWoke = true; esp_schedule(); });
+    wifi_fpm_do_sleep(ms * 1000);
+    esp_delay(ms + 1, []()
+              { return !lightSleepWoke; });
+    gpio_pin_wakeup_disable();
+    wifi_fpm_close();
+
+    uint32_t sleptMs = (uint64_t)(system_get_rtc_time() - rtcStart) * cali / 4096 / 1000;
+    unsigned long countedMs = millis() - millisStart;
+    if (sleptMs > countedMs)
+    {
+        // millis() stands still in light sleep, keep clockNow() honest
+        rtcClock.baseMs += sleptMs - countedMs;
+    }
+    powerAdd(LOAD_LIGHT_SLEEP, sleptMs, min((unsigned long)sleptMs, countedMs));
+    return sleptMs;
+}
+
+bool lightSleepUntil(uint64_t deadline, int pin, int wakeLevel)
+{
+    WiFi.mode(WIFI_OFF);
+    uint64_t startedAt = clockNow();
+    uint64_t sleptMs = 0;
+    bool pinWoke = digitalRead(pin) == wakeLevel;
+
+    while (!pinWoke && clockNow() < deadline)
+    {
+        uint32_t chunkMs = min(deadline - clockNow(), (uint64_t)LIGHT_SLEEP_MAX_MS);
+        sleptMs += lightSleepChunk(chunkMs, pin, wakeLevel);
+        pinWoke = digitalRead(pin) == wakeLevel;
+    }
+
+    uint64_t elapsedMs = clockNow() - startedAt;
+    if (elapsedMs > 0)
+    {
+        uint64_t awakeMs = elapsedMs > sleptMs ? elapsedMs - sleptMs : 0;
+        uint32_t averageUa = (sleptMs * LIGHT_SLEEP_UA + awakeMs * IDLE_AWAKE_UA) / elapsedMs;
+        Serial.printf("Light sleep: %lu ms asleep, %lu ms awake, ~%lu uA average (delay() would be ~%lu uA)\n",
+                      (unsigned long)sleptMs, (unsigned long)awakeMs, (unsigned long)averageUa, (unsigned long)IDLE_AWAKE_UA);
+    }
+    return pinWoke;
+}
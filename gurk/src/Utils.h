@@ -3,8 +3,41 @@
 
 #include <Arduino.h>
 #include "WiFiManager.h"
+#include "RtcMemory.h"
 
 void shutdown(String message);
-void go_to_sleep(int sleepTime);
+
+// Deep sleep for sleepTime ms, or until a clockNow() deadline. Sleeps longer
+// than the hardware allows are split into the fewest possible chunks, with the
+// radio off on the wakes in between. The pending sleep is kept in RTC memory;
+// resumeSleep() must run early in setup() and only returns once the sleep is
+// over. Neither of the sleep calls returns.
+const unsigned long DEEP_SLEEP_MIN_WAIT = 30000; // shorter waits are not worth a reboot
+
+void go_to_sleep(uint64_t sleepTime);
+void sleepUntil(uint64_t deadline);
+void resumeSleep();
+
+// Forced light sleep with the radio off until a clockNow() deadline, for
+// waits too short to pay for a deep sleep reboot. Wakes early, returning
+// true, once pin reads wakeLevel.
+bool lightSleepUntil(uint64_t deadline, int pin, int wakeLevel);
+
+// Millisecond clock that keeps counting across deep sleep. The epoch changes
+// whenever continuity is lost (power on, crash), so timestamps from another
+// epoch must not be compared with clockNow().
+void clockBegin();
+uint64_t clockNow();
+uint32_t clockEpoch();
+void clockAdvance(uint64_t sleepMs);
+
+// Feeds a server timestamp (Unix seconds, e.g. from an HTTP Date header)
+// taken at clockNow() atMs. Over spans with enough deep sleep this learns how
+// far the RTC is off, corrects every later deep sleep for it and pulls the
+// clock back onto server time.
+void clockCalibrate(uint32_t serverS, uint64_t atMs);
+// Slack to leave before a deadline after sleeping sleepMs, small once the
+// drift is known
+uint32_t wakeMarginMs(uint64_t sleepMs);
 
 #endif 
\ No newline at end of file
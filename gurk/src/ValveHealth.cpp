@@ -0,0 +1,105 @@
+#include "ValveHealth.h"
+#include "Config.h"
+#include <EEPROM.h>
+
+const float TRAVEL_EMA_WEIGHT = 0.125;    // weight of the newest travel
+const uint16_t TRAVEL_WARMUP = 8;         // travels before the average is trusted
+const float SLOW_FACTOR = 1.5;            // average this far over the learned baseline is slow
+const float SLOW_SHARE_OF_TIMEOUT = 0.7;  // so is an average this close to maxOnDuration
+const float TIMEOUT_SIGMAS = 4;           // timeout margin in standard deviations...
+const float TIMEOUT_MIN_MARGIN = 0.5;     // ...but at least half the average on top
+const unsigned long TIMEOUT_FLOOR = 1000; // and never below a second
+
+struct TravelStats
+{
+    float mean;     // ms
+    float variance; // ms^2
+    float baseline; // mean once warmed up, what a healthy valve does
+    uint16_t samples;
+    uint8_t alerted; // slow event already queued for this episode
+    uint8_t reserved;
+};
+
+struct TravelRecord
+{
+    uint32_t crc;
+    TravelStats directions[2]; // closing, opening
+};
+
+static TravelRecord record;
+static bool recordLoaded = false;
+
+static void loadRecord()
+{
+    if (recordLoaded)
+    {
+        return;
+    }
+
+    EEPROM.begin(sizeof(record));
+    EEPROM.get(0, record);
+    if (crc32(record.directions, sizeof(record.directions)) != record.crc)
+    {
+        memset(&record, 0, sizeof(record));
+    }
+    recordLoaded = true;
+}
+
+static void saveRecord()
+{
+    record.crc = crc32(record.directions, sizeof(record.directions));
+    EEPROM.put(0, record);
+    EEPROM.commit();
+}
+
+unsigned long travelTimeout(bool opening)
+{
+    loadRecord();
+    const TravelStats &stats = record.directions[opening];
+    if (stats.samples < TRAVEL_WARMUP)
+    {
+        return maxOnDuration;
+    }
+
+    float margin = max(TIMEOUT_SIGMAS * sqrtf(stats.variance), TIMEOUT_MIN_MARGIN * stats.mean);
+    unsigned long timeout = max((unsigned long)(stats.mean + margin), TIMEOUT_FLOOR);
+    return min(timeout, maxOnDuration);
+}
+
+void recordTravel(bool opening, unsigned long ms)
+{
+    loadRecord();
+    TravelStats &stats = record.directions[opening];
+    if (stats.samples == 0)
+    {
+        stats.mean = ms;
+        stats.variance = 0;
+    }
+    else
+    {
+        float delta = ms - stats.mean;
+        stats.mean += TRAVEL_EMA_WEIGHT * delta;
+        stats.variance = (1 - TRAVEL_EMA_WEIGHT) * (stats.variance + TRAVEL_EMA_WEIGHT * delta * delta);
+    }
+    if (stats.samples < UINT16_MAX)
+    {
+        stats.samples++;
+    }
+    if (stats.samples == TRAVEL_WARMUP)
+    {
+        stats.baseline = stats.mean;
+    }
+
+    bool slow = stats.samples >= TRAVEL_WARMUP &&
+                (stats.mean > SLOW_FACTOR * stats.baseline || stats.mean > SLOW_SHARE_OF_TIMEOUT * maxOnDuration);
+    if (slow && !stats.alerted)
+    {
+        // Positive for opening, negative for closing
+        queueEvent(EVENT_VALVE_SLOW, opening ? (int16_t)stats.mean : -(int16_t)stats.mean);
+    }
+    stats.alerted = slow;
+    saveRecord();
+
+    Serial.printf("Travel %s: %lu ms, average %lu +- %lu ms, timeout %lu ms%s\n", opening ? "open" : "close", ms,
+                  (unsigned long)stats.mean, (unsigned long)sqrtf(stats.variance), travelTimeout(opening), slow ? ", slow" : "");
+}
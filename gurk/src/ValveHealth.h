@@ -0,0 +1,15 @@
+#ifndef VALVE_HEALTH_H
+#define VALVE_HEALTH_H
+
+#include <Arduino.h>
+#include "EventQueue.h"
+
+// Learns how long the valve takes to travel in each direction, as an
+// exponential moving average and variance kept in EEPROM so it survives power
+// cycles. A valve that gets slower raises EVENT_VALVE_SLOW well before it
+// would run into maxOnDuration, and once enough travels are known the motor
+// timeout is tightened to what the valve normally needs plus a margin.
+unsigned long travelTimeout(bool opening);
+void recordTravel(bool opening, unsigned long ms);
+
+#endif
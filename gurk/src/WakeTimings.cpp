@@ -0,0 +1,128 @@
+#include "WakeTimings.h"
+#include "Utils.h"
+#include <algorithm>
+
+static const char *PHASE_NAMES[PHASE_COUNT] = {"assoc", "dhcp", "dns", "tls", "ttfb", "decode"};
+
+const uint32_t DEFAULT_WAKE_LATENCY = 20000; // until there is a history to go by
+const uint8_t MIN_LATENCY_SAMPLES = 3;
+
+static_assert(rtcBlocks(sizeof(WakeTimings)) <= RTC_SLOT_SLEEP - RTC_SLOT_TIMINGS, "Wake timings outgrew their RTC slot");
+
+static WakeTimings timings;
+static bool timingsLoaded = false;
+
+struct WakeLatencies
+{
+    uint16_t ms[WAKE_LATENCY_SAMPLES];
+    uint8_t head;
+    uint8_t count;
+};
+
+static_assert(rtcBlocks(sizeof(WakeLatencies)) <= RTC_SLOT_END - RTC_SLOT_LATENCY, "Wake latency history outgrew its RTC slot");
+
+static WakeLatencies latencies;
+static bool latenciesLoaded = false;
+static uint64_t wokeAt = 0;
+static bool wakePending = false;
+
+static void loadTimings()
+{
+    if (!timingsLoaded && !rtcLoad(RTC_SLOT_TIMINGS, &timings, sizeof(timings)))
+    {
+        memset(&timings, 0, sizeof(timings));
+    }
+    timingsLoaded = true;
+}
+
+void recordPhase(WakePhase phase, uint32_t us)
+{
+    loadTimings();
+    timings.us[phase] = us;
+    rtcSave(RTC_SLOT_TIMINGS, &timings, sizeof(timings));
+}
+
+const WakeTimings &wakeTimings()
+{
+    loadTimings();
+    return timings;
+}
+
+bool wakeTimingsPending()
+{
+    loadTimings();
+    for (uint32_t us : timings.us)
+    {
+        if (us != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void clearWakeTimings()
+{
+    memset(&timings, 0, sizeof(timings));
+    timingsLoaded = true;
+    rtcSave(RTC_SLOT_TIMINGS, &timings, sizeof(timings));
+}
+
+// One line, e.g. "Wake us: assoc=812345 dhcp=0 dns=0 tls=402113 ttfb=95210 decode=1200"
+void printWakeTimings()
+{
+    loadTimings();
+    Serial.print("Wake us:");
+    for (uint8_t i = 0; i < PHASE_COUNT; i++)
+    {
+        Serial.printf(" %s=%u", PHASE_NAMES[i], timings.us[i]);
+    }
+    Serial.println();
+}
+
+static void loadLatencies()
+{
+    if (!latenciesLoaded && !rtcLoad(RTC_SLOT_LATENCY, &latencies, sizeof(latencies)))
+    {
+        memset(&latencies, 0, sizeof(latencies));
+    }
+    latenciesLoaded = true;
+}
+
+void markWake(uint64_t at)
+{
+    wokeAt = at;
+    wakePending = true;
+}
+
+void markReady()
+{
+    if (!wakePending)
+    {
+        return;
+    }
+    wakePending = false;
+
+    loadLatencies();
+    uint64_t latency = min(clockNow() - wokeAt, (uint64_t)UINT16_MAX);
+    latencies.ms[latencies.head] = latency;
+    latencies.head = (latencies.head + 1) % WAKE_LATENCY_SAMPLES;
+    latencies.count = min<uint8_t>(latencies.count + 1, WAKE_LATENCY_SAMPLES);
+    rtcSave(RTC_SLOT_LATENCY, &latencies, sizeof(latencies));
+    Serial.printf("Wake to ready: %lu ms\n", (unsigned long)latency);
+}
+
+uint32_t predictedWakeLatency(uint8_t percentile)
+{
+    loadLatencies();
+    if (latencies.count < MIN_LATENCY_SAMPLES)
+    {
+        return DEFAULT_WAKE_LATENCY;
+    }
+
+    uint16_t sorted[WAKE_LATENCY_SAMPLES];
+    memcpy(sorted, latencies.ms, sizeof(sorted));
+    std::sort(sorted, sorted + latencies.count);
+    uint8_t rank = (percentile * latencies.count + 99) / 100; // nearest-rank
+    return sorted[constrain(rank, 1, latencies.count) - 1];
+}
@@ -0,0 +1,40 @@
+#ifndef WAKE_TIMINGS_H
+#define WAKE_TIMINGS_H
+
+#include <Arduino.h>
+#include "RtcMemory.h"
+
+enum WakePhase : uint8_t
+{
+    PHASE_ASSOCIATE,  // WiFi.begin() until the AP accepted us
+    PHASE_DHCP,       // association until we had an IP
+    PHASE_DNS,        // server name lookup
+    PHASE_TLS,        // TCP connect and TLS handshake
+    PHASE_FIRST_BYTE, // request sent until the first byte of the response
+    PHASE_DECODE,     // parsing the device variables
+    PHASE_COUNT,
+};
+
+// Latest duration of each network phase in microseconds. Kept in RTC memory
+// so a wake that never got to upload still reports with the next one.
+struct WakeTimings
+{
+    uint32_t us[PHASE_COUNT];
+};
+
+void recordPhase(WakePhase phase, uint32_t us);
+const WakeTimings &wakeTimings();
+bool wakeTimingsPending();
+void clearWakeTimings();
+void printWakeTimings();
+
+// Wake-to-ready latency: from the end of a sleep until fresh device variables
+// are in hand, which covers boot, association, TLS and the request. The last
+// WAKE_LATENCY_SAMPLES are kept in RTC memory.
+const uint8_t WAKE_LATENCY_SAMPLES = 8;
+
+void markWake(uint64_t at); // clockNow() the sleep ended
+void markReady();           // records the latency since markWake(), if any
+uint32_t predictedWakeLatency(uint8_t percentile);
+
+#endif
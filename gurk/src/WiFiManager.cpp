@@ -1,35 +1,229 @@
 #include <WiFiManager.h>
+#include "HTTPHandler.h"
+#include "EventQueue.h"
+#include "Config.h"
+#include "Energy.h"
 
-const unsigned long RECONNECT_INTERVAL = 5000;  // 5 seconds
-const unsigned long RECONNECT_TIMEOUT = 120000; // 2 minutes
-const unsigned long STANDBY_DURATION = 7200000; // 2 hours
+const unsigned long RECONNECT_INTERVAL = 5000;   // 5 seconds
+const unsigned long RECONNECT_TIMEOUT = 120000;  // 2 minutes
+const unsigned long STANDBY_DURATION = 7200000;  // 2 hours
+const unsigned long FAST_CONNECT_TIMEOUT = 3000; // 3 seconds, then the cached lease counts as stale
+const uint8_t LEASE_REFRESH_CONNECTS = 12;       // full DHCP every 12 fast connects keeps the router lease alive
 
-void connectToWiFi(const char *ssid, const char *password)
+static WiFiEventHandler associatedHandler;
+static WiFiEventHandler gotIpHandler;
+static WiFiEventHandler disconnectedHandler;
+static volatile uint32_t beginAt = 0;
+static volatile uint32_t associatedAt = 0;
+static volatile uint32_t gotIpAt = 0;
+static volatile bool linkDropped = false;
+
+enum ConnectState
+{
+    CONNECT_IDLE,
+    CONNECT_FAST,
+    CONNECT_FULL
+};
+
+static ConnectState connectState = CONNECT_IDLE;
+static const char *connectSsid = nullptr;
+static const char *connectPassword = nullptr;
+static uint32_t connectStartedAt = 0;
+static uint8_t leaseConnects = 0;
+
+static unsigned long radioOnSince = 0;
+static unsigned long radioOnTotal = 0;
+static bool radioOn = false;
+
+// Last good association, kept in RTC memory so the next wake can skip the scan and DHCP
+struct WiFiLease
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t fastConnects;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+static_assert(rtcBlocks(sizeof(WiFiLease)) <= RTC_SLOT_TLS - RTC_SLOT_WIFI, "WiFi lease outgrew its RTC slot");
+
+// Starts a connect attempt and the timestamps the phase timers are taken from
+static void beginConnect(const char *ssid, const char *password, int32_t channel = 0, const uint8_t *bssid = nullptr)
+{
+    if (!associatedHandler)
+    {
+        associatedHandler = WiFi.onStationModeConnected([](const WiFiEventStationModeConnected &)
+                                                        { associatedAt = micros(); });
+        gotIpHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &)
+                                               { gotIpAt = micros(); esp_schedule(); });
+        disconnectedHandler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected &)
+                                                             { linkDropped = true; esp_schedule(); });
+    }
+    associatedAt = 0;
+    gotIpAt = 0;
+    linkDropped = false;
+    beginAt = micros();
+    WiFi.begin(ssid, password, channel, bssid);
+}
+
+static void recordConnectPhases()
+{
+    if (associatedAt != 0 && gotIpAt != 0)
+    {
+        recordPhase(PHASE_ASSOCIATE, associatedAt - beginAt);
+        recordPhase(PHASE_DHCP, gotIpAt - associatedAt);
+    }
+}
+
+static bool beginFastConnect(const char *ssid, const char *password)
+{
+    WiFiLease lease;
+    if (!rtcLoad(RTC_SLOT_WIFI, &lease, sizeof(lease)) || lease.fastConnects >= LEASE_REFRESH_CONNECTS)
+    {
+        return false;
+    }
+
+    WiFi.config(IPAddress(lease.ip), IPAddress(lease.gateway), IPAddress(lease.subnet), IPAddress(lease.dns));
+    beginConnect(ssid, password, lease.channel, lease.bssid);
+    leaseConnects = lease.fastConnects;
+    return true;
+}
+
+// The cached AP or lease is stale, forget it and go back to scanning and DHCP
+static void fallBackToFullConnect()
+{
+    Serial.println("Fast connect failed, falling back to full connect");
+    rtcClear(RTC_SLOT_WIFI);
+    WiFi.disconnect();
+    WiFi.config(0U, 0U, 0U);
+    beginConnect(connectSsid, connectPassword);
+    connectState = CONNECT_FULL;
+}
+
+// Sleeps until the got-IP event fires, the link drops or the timeout runs out
+static void awaitConnectEvent(unsigned long timeout)
+{
+    esp_delay(timeout, []()
+              { return gotIpAt == 0 && !linkDropped; });
+}
+
+static void saveLease(uint8_t fastConnects)
+{
+    WiFiLease lease;
+    memcpy(lease.bssid, WiFi.BSSID(), sizeof(lease.bssid));
+    lease.channel = WiFi.channel();
+    lease.fastConnects = fastConnects;
+    lease.ip = WiFi.localIP();
+    lease.gateway = WiFi.gatewayIP();
+    lease.subnet = WiFi.subnetMask();
+    lease.dns = WiFi.dnsIP();
+    rtcSave(RTC_SLOT_WIFI, &lease, sizeof(lease));
+}
+
+void beginWiFi(const char *ssid, const char *password)
 {
     Serial.print("Connecting to ");
     Serial.println(ssid);
-    WiFi.begin(ssid, password);
 
-    unsigned long startTime = millis();
-    while (WiFi.status() != WL_CONNECTED)
+    if (!radioOn)
     {
-        delay(500);
-        Serial.print(".");
-        if (millis() - startTime > RECONNECT_TIMEOUT)
+        radioOnSince = millis();
+        radioOn = true;
+        powerOn(LOAD_RADIO);
+    }
+    connectSsid = ssid;
+    connectPassword = password;
+    connectStartedAt = micros();
+    if (beginFastConnect(ssid, password))
+    {
+        connectState = CONNECT_FAST;
+    }
+    else
+    {
+        beginConnect(ssid, password);
+        connectState = CONNECT_FULL;
+    }
+}
+
+bool wifiReady()
+{
+    if (connectState == CONNECT_FAST && gotIpAt == 0 &&
+        (linkDropped || micros() - beginAt > FAST_CONNECT_TIMEOUT * 1000))
+    {
+        fallBackToFullConnect();
+    }
+    return gotIpAt != 0;
+}
+
+void waitForWiFi()
+{
+    if (connectState == CONNECT_IDLE)
+    {
+        return;
+    }
+
+    while (!wifiReady())
+    {
+        unsigned long elapsed = (micros() - beginAt) / 1000;
+        unsigned long timeout = connectState == CONNECT_FAST ? FAST_CONNECT_TIMEOUT : RECONNECT_TIMEOUT;
+        if (connectState == CONNECT_FULL && elapsed >= timeout)
         {
-            Serial.println("\nFailed to connect. Entering standby mode.");
-            delay(STANDBY_DURATION);
+            Serial.println("Failed to connect. Entering standby mode.");
+            go_to_sleep(STANDBY_DURATION);
             return;
         }
+        if (connectState == CONNECT_FULL)
+        {
+            linkDropped = false; // a full connect rides out drops, the SDK keeps retrying until the timeout
+        }
+        awaitConnectEvent(elapsed < timeout ? timeout - elapsed : 0);
     }
 
-    Serial.println("\nWiFi connected");
+    bool fast = connectState == CONNECT_FAST;
+    connectState = CONNECT_IDLE;
+    saveLease(fast ? leaseConnects + 1 : 0);
+    recordConnectPhases();
+
+    Serial.println("WiFi connected");
+    Serial.printf("Time to IP: %lu ms (%s connect)\n", (unsigned long)(gotIpAt - connectStartedAt) / 1000, fast ? "fast" : "full");
     Serial.println("IP address: ");
     Serial.println(WiFi.localIP());
 }
 
-void disconnectFromWiFi()
+void connectToWiFi(const char *ssid, const char *password)
+{
+    beginWiFi(ssid, password);
+    waitForWiFi();
+}
+
+void disconnectFromWiFi(bool flush)
 {
     Serial.println("Disconnecting WiFi");
+    if (wakeTimingsPending())
+    {
+        printWakeTimings();
+    }
+    printEnergyUse();
+    printCycleEnergy();
+    if (flush)
+    {
+        flushEvents(eventsUrl);
+    }
+    serverSession.close();
     WiFi.mode(WIFI_OFF);
+    connectState = CONNECT_IDLE;
+    gotIpAt = 0;
+    if (radioOn)
+    {
+        radioOnTotal += millis() - radioOnSince;
+        radioOn = false;
+        powerOff(LOAD_RADIO);
+    }
+}
+
+unsigned long radioOnTime()
+{
+    return radioOnTotal + (radioOn ? millis() - radioOnSince : 0);
 }
@@ -3,8 +3,14 @@
 
 #include <ESP8266WiFi.h>
 #include "Utils.h"
+#include "RtcMemory.h"
+#include "WakeTimings.h"
 
+void beginWiFi(const char *ssid, const char *password); // starts associating and returns straight away
+bool wifiReady();                                        // true once the station has an IP
+void waitForWiFi();                                      // sleeps until the got-IP event, standby on timeout
 void connectToWiFi(const char *ssid, const char *password);
-void disconnectFromWiFi();
+void disconnectFromWiFi(bool flush = true); // flush: upload the queued events first, only worth it while the server answers
+unsigned long radioOnTime(); // ms the radio has been up since boot
 
 #endif
@@ -7,23 +7,48 @@
 #include "HTTPHandler.h"
 #include "MotorHandler.h"
 #include "Config.h"
+#include "RetryPolicy.h"
+#include "Energy.h"
 
 const char *ssid = "Eagle_389AD0";
 const char *password = "CiKbPq6b";
 const char *serverUrl = "https://gurkvattning.onrender.com/get_device_variables";
-const char *noButtonSignalUrl = "https://gurkvattning.onrender.com/no_button_signal";
-const char *set_is_watering_rul = "https://gurkvattning.onrender.com/set_is_watering";
+const char *eventsUrl = "https://gurkvattning.onrender.com/log_events";
 
 // Define variables to hold the constants fetched from the server
-const int pinMotor = 16;
+const int pinMotor = 5;                 // D1; GPIO16 (D0) is wired to RST so timed deep sleep can wake the chip
 const int pinInput = 2;
+const int pinFlow = -1;                 // hall-effect flow meter, e.g. 4 on units that have one
+const float flowPulsesPerLitre = 450.0; // YF-S201, calibrate against a bucket
 const unsigned long maxOnDuration = 10000;
 const int errorTimeout = 20000; // 20 sekunder
+const unsigned long wateringTolerance = 2000; // how late the valve may open, ms
+const uint8_t wakeLatencyPercentile = 90;     // wake-to-ready percentile planned for
+const DebounceMode switchDebounceMode = DEBOUNCE_STABLE_TIME;
+const uint8_t switchDebounceSamples = 5; // 1 ms samples, so 5 ms of steady contact
+
+// Current draw per power load in microamps, for the energy estimate. The
+// radio, TX and motor figures come on top of the CPU; measure the board and
+// the motor supply and adjust.
+const uint32_t loadCurrentUa[LOAD_COUNT] = {
+    15000,  // LOAD_CPU
+    55000,  // LOAD_RADIO
+    100000, // LOAD_TX
+    900,    // LOAD_LIGHT_SLEEP
+    20,     // LOAD_DEEP_SLEEP
+    250000, // LOAD_MOTOR
+};
 
 void setup()
 {
   Serial.begin(115200);
   delay(10);
+  clockBegin();
+  energyBegin();
+  resumeSleep();
+  pinMode(pinMotor, OUTPUT);
+  pinMode(pinInput, INPUT_PULLUP); // Enable internal pull-up resistor
+  bool resumedWatering = resumeWatering();
 
   // This is part of power saving
   WiFi.mode(WIFI_OFF);
@@ -36,35 +61,67 @@ void setup()
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
   Serial.println("I setup");
-  connectToWiFi(ssid, password);
-  pinMode(pinMotor, OUTPUT);
-  pinMode(pinInput, INPUT_PULLUP); // Enable internal pull-up resistor
+
+  // Home the valve while the station associates, then pick up the IP. A
+  // resumed watering cycle has already left the valve at rest, and so has
+  // the boot before a deep sleep unless its last move went wrong. The end of
+  // a deep sleep, such as the one between polls, times the wake-to-ready
+  // latency.
+  if (ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE && !resumedWatering)
+  {
+    markWake(clockNow() - millis());
+  }
+  beginWiFi(ssid, password);
+  if (!resumedWatering && !valveLeftAtRest())
+  {
+    resetMotor();
+  }
+  waitForWiFi();
   Serial.println("Setup complete");
-  resetMotor();
+}
+
+// Waits out the back-off with the radio off, in deep sleep once this wake
+// has used up its retry budget or the wait is long enough to pay for a reboot.
+// The server just failed, so the events stay queued in RTC memory for the
+// next wake that reaches it.
+void retryAfterFailure()
+{
+  unsigned long retryDelay = retryFailed();
+  disconnectFromWiFi(false);
+  if (retryBudgetSpent() || retryDelay >= DEEP_SLEEP_MIN_WAIT)
+  {
+    go_to_sleep(retryDelay);
+  }
+  delay(retryDelay);
+  connectToWiFi(ssid, password);
 }
 
 void loop()
 {
   if (WiFi.status() == WL_CONNECTED)
   {
-    String payload = sendRequestToServer(serverUrl);
-    if (payload != "error")
+    DeviceVariables vars;
+    if (fetchDeviceVariables(serverUrl, vars, watchValve))
     {
-      processResponse(payload);
+      retrySucceeded();
+      markReady();
+      if (takeValveDisplaced())
+      {
+        Serial.println("Valve moved while idle, homing it");
+        resetMotor();
+      }
+      processResponse(vars);
     }
     else
     {
-      disconnectFromWiFi();
-      delay(errorTimeout);
-      connectToWiFi(ssid, password);
       Serial.println("Error");
+      retryAfterFailure();
     }
   }
   else
   {
     Serial.println("WiFi Disconnected");
-    delay(errorTimeout);
-    connectToWiFi(ssid, password);
+    retryAfterFailure();
   }
   delay(1000); // Add a delay to reduce the serial output frequency
 }
\ No newline at end of file
@@ -0,0 +1,330 @@
+// Host stand-in for the ESP8266 Arduino core, for the native test env.
+//
+// Only what the firmware uses is here, and all of it is header-only so a
+// test suite that #includes the sources it covers needs nothing else. Time
+// is simulated: millis() and micros() only move when the firmware waits, in
+// delay(), esp_delay() or delayMicroseconds(), and every simulated
+// millisecond runs the timer1 interrupt and the test's onMillisecond hook.
+// Everything a real board keeps across deep sleep (the clock, RTC memory,
+// EEPROM, pin levels) lives in host::Board, so a test can put it in shared
+// memory and run each boot in a fresh process.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#define ARDUINO 10819
+#define ARDUINO_ARCH_ESP8266
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+// Flash is ordinary memory on the host
+#define PROGMEM
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+#define pgm_read_ptr(p) (*(const void *const *)(p))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define digitalPinToInterrupt(p) (p)
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef unsigned int uint;
+class __FlashStringHelper;
+
+using std::max;
+using std::min;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#include "HostBoard.h"
+#include "Esp.h"
+
+class String
+{
+public:
+    String(const char *s = "") : s(s ? s : "") {}
+    String(const std::string &s) : s(s) {}
+    String(int value) : s(std::to_string(value)) {}
+    String(unsigned int value) : s(std::to_string(value)) {}
+    String(long value) : s(std::to_string(value)) {}
+    String(unsigned long value) : s(std::to_string(value)) {}
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool isEmpty() const { return s.empty(); }
+    bool reserve(unsigned int size)
+    {
+        s.reserve(size);
+        return true;
+    }
+    bool concat(const char *more)
+    {
+        s += more;
+        return true;
+    }
+    String &operator+=(const String &more)
+    {
+        s += more.s;
+        return *this;
+    }
+    bool operator==(const char *other) const { return s == other; }
+    bool operator!=(const char *other) const { return s != other; }
+    char operator[](unsigned int i) const { return s[i]; }
+
+private:
+    std::string s;
+};
+
+inline String operator+(const String &a, const String &b)
+{
+    String sum = a;
+    sum += b;
+    return sum;
+}
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && write(buffer[n]))
+        {
+            n++;
+        }
+        return n;
+    }
+
+    size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t print(const String &s) { return print(s.c_str()); }
+    size_t print(const __FlashStringHelper *s) { return print((const char *)s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n) { return printf("%d", n); }
+    size_t print(unsigned int n) { return printf("%u", n); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t print(unsigned long n) { return printf("%lu", n); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+
+    size_t println() { return print("\r\n"); }
+    template <typename T>
+    size_t println(T value)
+    {
+        return print(value) + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return write((const uint8_t *)buffer, std::min((size_t)std::max(length, 0), sizeof(buffer) - 1));
+    }
+};
+
+class Printable
+{
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+void delay(unsigned long ms);
+unsigned long millis();
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long ms) { timeout = ms; }
+    unsigned long getTimeout() const { return timeout; }
+
+    virtual size_t readBytes(char *buffer, size_t length)
+    {
+        size_t n = 0;
+        while (n < length)
+        {
+            int c = timedRead();
+            if (c < 0)
+            {
+                break;
+            }
+            buffer[n++] = c;
+        }
+        return n;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+protected:
+    int timedRead()
+    {
+        unsigned long start = millis();
+        do
+        {
+            int c = read();
+            if (c >= 0)
+            {
+                return c;
+            }
+            delay(1);
+        } while (millis() - start < timeout);
+        return -1;
+    }
+
+    unsigned long timeout = 1000;
+};
+
+// Serial output goes to stdout, and nothing ever comes in
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+    void flush() { fflush(stdout); }
+};
+
+inline HardwareSerial Serial;
+
+inline unsigned long millis()
+{
+    return (host::board->nowUs - host::board->bootUs) / 1000;
+}
+
+inline unsigned long micros()
+{
+    return (uint32_t)(host::board->nowUs - host::board->bootUs);
+}
+
+inline void delay(unsigned long ms)
+{
+    host::advanceUs((uint64_t)ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+    host::advanceUs(us);
+}
+
+inline void yield() {}
+inline void esp_yield() {}
+inline void esp_schedule() {}
+
+inline void esp_delay(unsigned long ms)
+{
+    delay(ms);
+}
+
+// Waits up to ms, a millisecond at a time, for as long as blocked() holds
+template <typename T>
+void esp_delay(unsigned long ms, T &&blocked)
+{
+    unsigned long start = millis();
+    while (blocked() && millis() - start < ms)
+    {
+        delay(1);
+    }
+}
+
+inline void pinMode(uint8_t, uint8_t) {}
+
+inline void digitalWrite(uint8_t pin, uint8_t level)
+{
+    host::board->pins[pin] = level ? HIGH : LOW;
+}
+
+inline int digitalRead(uint8_t pin)
+{
+    return host::board->pins[pin];
+}
+
+inline void attachInterrupt(uint8_t, void (*)(void), int) {}
+inline void detachInterrupt(uint8_t) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#define TIM_DIV1 0
+#define TIM_DIV16 1
+#define TIM_DIV256 3
+#define TIM_EDGE 0
+#define TIM_LEVEL 1
+#define TIM_SINGLE 0
+#define TIM_LOOP 1
+
+inline void timer1_attachInterrupt(timercallback callback)
+{
+    host::timer1Callback = callback;
+}
+
+inline void timer1_detachInterrupt()
+{
+    host::timer1Callback = nullptr;
+}
+
+inline void timer1_enable(uint8_t divider, uint8_t, uint8_t reload)
+{
+    host::timer1Divider = divider;
+    host::timer1Loop = reload == TIM_LOOP;
+}
+
+inline void timer1_write(uint32_t ticks)
+{
+    // 80 MHz divided by 1, 16 or 256
+    host::timer1PeriodUs = host::timer1Divider == TIM_DIV1 ? ticks / 80 : host::timer1Divider == TIM_DIV16 ? ticks / 5 : ticks * 16 / 5;
+    host::timer1DueUs = host::board->nowUs + host::timer1PeriodUs;
+    host::timer1Enabled = true;
+}
+
+inline void timer1_disable()
+{
+    host::timer1Enabled = false;
+}
+
+inline uint32_t crc32(const void *data, size_t length, uint32_t crc = 0xffffffff)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length--)
+    {
+        crc ^= *bytes++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+inline EspClass ESP;
+
+#endif
@@ -0,0 +1,31 @@
+// Host stand-in for the ESP8266 EEPROM library, backed by host::Board
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+public:
+    void begin(size_t) {}
+    bool commit() { return true; }
+
+    template <typename T>
+    T &get(int address, T &value)
+    {
+        memcpy(&value, &host::board->eeprom[address], sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    const T &put(int address, const T &value)
+    {
+        static_assert(sizeof(T) <= sizeof(host::board->eeprom), "Record does not fit the emulated EEPROM");
+        memcpy(&host::board->eeprom[address], &value, sizeof(T));
+        return value;
+    }
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,44 @@
+// Host stand-in for ESP8266HTTPClient: only the codes the firmware uses
+#ifndef HOST_ESP8266HTTPCLIENT_H
+#define HOST_ESP8266HTTPCLIENT_H
+
+#include <ESP8266WiFi.h>
+
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_TOO_LESS_RAM (-8)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+enum t_http_codes
+{
+    HTTP_CODE_OK = 200,
+    HTTP_CODE_NO_CONTENT = 204,
+    HTTP_CODE_NOT_MODIFIED = 304,
+    HTTP_CODE_UNSUPPORTED_MEDIA_TYPE = 415,
+};
+
+class HTTPClient
+{
+public:
+    static String errorToString(int error)
+    {
+        switch (error)
+        {
+        case HTTPC_ERROR_CONNECTION_FAILED:
+            return "connection failed";
+        case HTTPC_ERROR_SEND_HEADER_FAILED:
+            return "send header failed";
+        case HTTPC_ERROR_CONNECTION_LOST:
+            return "connection lost";
+        case HTTPC_ERROR_TOO_LESS_RAM:
+            return "too less ram";
+        case HTTPC_ERROR_READ_TIMEOUT:
+            return "read Timeout";
+        default:
+            return String();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+// Host stand-in for the ESP8266WiFi library, see Arduino.h. The station is
+// connected or not as the test says; clients are plain POSIX TCP sockets.
+#ifndef HOST_ESP8266WIFI_H
+#define HOST_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7,
+} wl_status_t;
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3,
+} WiFiMode_t;
+
+namespace host
+{
+inline wl_status_t wifiStatus = WL_DISCONNECTED;
+// When set, every client connects to this port on 127.0.0.1 whatever host
+// and port it asked for, so the firmware's https:// URLs reach a local server
+inline uint16_t serverPort = 0;
+} // namespace host
+
+class IPAddress : public Printable
+{
+public:
+    IPAddress(uint32_t address = 0) : address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+
+    operator uint32_t() const { return address; }
+    bool isSet() const { return address != 0; }
+
+    size_t printTo(Print &p) const override
+    {
+        return p.printf("%u.%u.%u.%u", address & 0xFF, address >> 8 & 0xFF, address >> 16 & 0xFF, address >> 24);
+    }
+
+private:
+    uint32_t address; // network order, as lwIP keeps it
+};
+
+class ESP8266WiFiClass
+{
+public:
+    wl_status_t status() { return host::wifiStatus; }
+
+    bool mode(WiFiMode_t mode)
+    {
+        if (mode == WIFI_OFF)
+        {
+            host::wifiStatus = WL_DISCONNECTED;
+        }
+        return true;
+    }
+
+    void persistent(bool) {}
+    bool forceSleepBegin(uint32_t = 0) { return true; }
+    bool forceSleepWake() { return true; }
+
+    int hostByName(const char *name, IPAddress &address)
+    {
+        if (host::serverPort != 0)
+        {
+            address = IPAddress(127, 0, 0, 1);
+            return 1;
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(name, nullptr, &hints, &found) != 0 || !found)
+        {
+            return 0;
+        }
+        address = IPAddress(((sockaddr_in *)found->ai_addr)->sin_addr.s_addr);
+        freeaddrinfo(found);
+        return 1;
+    }
+};
+
+inline ESP8266WiFiClass WiFi;
+
+class WiFiClient : public Stream
+{
+public:
+    WiFiClient() {}
+    WiFiClient(const WiFiClient &) = delete;
+    virtual ~WiFiClient() { stop(); }
+
+    virtual int connect(IPAddress ip, uint16_t port)
+    {
+        stop();
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = host::serverPort != 0 ? htonl(INADDR_LOOPBACK) : (uint32_t)ip;
+        address.sin_port = htons(host::serverPort != 0 ? host::serverPort : port);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            stop();
+            return 0;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        return 1;
+    }
+
+    virtual int connect(const char *host, uint16_t port)
+    {
+        IPAddress address;
+        return WiFi.hostByName(host, address) ? connect(address, port) : 0;
+    }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        size_t sent = 0;
+        while (fd >= 0 && sent < size)
+        {
+            ssize_t n = send(fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN)
+            {
+                break;
+            }
+            sent += n > 0 ? n : 0;
+        }
+        return sent;
+    }
+
+    int available() override
+    {
+        fill();
+        return length - position;
+    }
+
+    int read() override { return available() > 0 ? buffer[position++] : -1; }
+    int peek() override { return available() > 0 ? buffer[position] : -1; }
+
+    // Like lwIP, a closed connection stays connected while data is unread
+    virtual uint8_t connected()
+    {
+        fill();
+        return fd >= 0 && (!closed || position < length);
+    }
+
+    virtual void stop()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = -1;
+        closed = false;
+        position = length = 0;
+    }
+
+private:
+    // Takes whatever the socket has without waiting for more
+    void fill()
+    {
+        if (fd < 0 || closed || position < length)
+        {
+            return;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            closed = true;
+        }
+        position = 0;
+        length = n > 0 ? n : 0;
+    }
+
+    int fd = -1;
+    bool closed = false;
+    uint8_t buffer[1460];
+    int position = 0;
+    int length = 0;
+};
+
+#include "WiFiClientSecure.h"
+
+#endif
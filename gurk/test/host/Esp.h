@@ -0,0 +1,76 @@
+// Host stand-in for the ESP8266 core's Esp.h, see Arduino.h
+#ifndef HOST_ESP_H
+#define HOST_ESP_H
+
+#include <string.h>
+#include "HostBoard.h"
+
+enum RFMode
+{
+    RF_DEFAULT = 0,
+    RF_CAL = 1,
+    RF_NO_CAL = 2,
+    RF_DISABLED = 4,
+};
+
+#define WAKE_RF_DEFAULT RF_DEFAULT
+#define WAKE_RFCAL RF_CAL
+#define WAKE_NO_RFCAL RF_NO_CAL
+#define WAKE_RF_DISABLED RF_DISABLED
+
+namespace host
+{
+// Thrown by ESP.deepSleep(), which never returns on the real chip either.
+// The test catches it, moves the clock on by us and boots again.
+struct DeepSleep
+{
+    uint64_t us;
+    RFMode mode;
+};
+
+// Thrown by ESP.reset() and ESP.restart()
+struct Reset
+{
+};
+} // namespace host
+
+class EspClass
+{
+public:
+    void deepSleep(uint64_t us, RFMode mode = RF_DEFAULT)
+    {
+        throw host::DeepSleep{us, mode};
+    }
+
+    // What the SDK reports for a typical RTC calibration, about 3.8 hours
+    uint64_t deepSleepMax() { return 13700000000ULL; }
+
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+    {
+        if (offset * 4 + size > sizeof(host::board->rtcMemory) || size % 4 != 0)
+        {
+            return false;
+        }
+        memcpy(data, &host::board->rtcMemory[offset], size);
+        return true;
+    }
+
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+    {
+        if (offset * 4 + size > sizeof(host::board->rtcMemory) || size % 4 != 0)
+        {
+            return false;
+        }
+        memcpy(&host::board->rtcMemory[offset], data, size);
+        return true;
+    }
+
+    void reset() { throw host::Reset{}; }
+    void restart() { throw host::Reset{}; }
+
+    rst_info *getResetInfoPtr() { return &host::board->resetInfo; }
+    uint32_t random() { return host::nextRandom(); }
+    uint32_t getFreeHeap() { return 40000; }
+};
+
+#endif
@@ -0,0 +1,149 @@
+// Simulated ESP8266 board behind the host fakes, see Arduino.h
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+
+struct rst_info
+{
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+enum rst_reason
+{
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6,
+};
+
+typedef void (*timercallback)(void);
+
+namespace host
+{
+const uint8_t PIN_COUNT = 17;
+
+// The part of the board that outlives a boot
+struct Board
+{
+    uint64_t nowUs;  // since power-on
+    uint64_t bootUs; // nowUs when the current boot started
+    uint32_t rtcMemory[128];
+    uint8_t eeprom[512];
+    uint8_t pins[PIN_COUNT]; // levels, driven by the firmware or the test
+    rst_info resetInfo;
+    uint32_t randomState;
+};
+
+// Power-on state: RTC memory and EEPROM blank, inputs pulled up
+const Board POWER_ON = {0, 0, {0}, {0}, {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}, {REASON_DEFAULT_RST, 0, 0, 0, 0, 0, 0}, 2463534242u};
+inline Board defaultBoard = POWER_ON;
+inline Board *board = &defaultBoard;
+
+// Called after every simulated millisecond, e.g. to move a motor
+inline void (*onMillisecond)() = nullptr;
+// Waits also take real time, for tests against a real server
+inline bool realTime = false;
+
+// Timer 1, ticking at 5 MHz after the divide by 16 the firmware uses
+inline timercallback timer1Callback = nullptr;
+inline bool timer1Enabled = false;
+inline bool timer1Loop = false;
+inline uint8_t timer1Divider = 1;
+inline uint32_t timer1PeriodUs = 0;
+inline uint64_t timer1DueUs = 0;
+
+// Forced light sleep in progress, see user_interface.h
+inline bool lightSleeping = false;
+inline uint64_t lightSleepWakeUs = 0;
+inline void (*lightSleepWakeCallback)() = nullptr;
+inline int pinWakeGpio = -1;
+inline int pinWakeLevel = 0;
+
+inline void checkLightSleepWake()
+{
+    if (!lightSleeping)
+    {
+        return;
+    }
+    bool pinWoke = pinWakeGpio >= 0 && board->pins[pinWakeGpio] == pinWakeLevel;
+    if (pinWoke || board->nowUs >= lightSleepWakeUs)
+    {
+        lightSleeping = false;
+        if (lightSleepWakeCallback)
+        {
+            lightSleepWakeCallback();
+        }
+    }
+}
+
+// Moves simulated time on, stopping at every millisecond boundary and timer
+// interrupt on the way
+inline void advanceUs(uint64_t us)
+{
+    uint64_t end = board->nowUs + us;
+    while (board->nowUs < end)
+    {
+        uint64_t next = std::min(end, (board->nowUs / 1000 + 1) * 1000);
+        if (timer1Enabled && timer1DueUs < next)
+        {
+            next = std::max(timer1DueUs, board->nowUs);
+        }
+        board->nowUs = next;
+
+        if (timer1Enabled && board->nowUs >= timer1DueUs)
+        {
+            timer1DueUs += timer1PeriodUs;
+            timer1Enabled = timer1Loop;
+            if (timer1Callback)
+            {
+                timer1Callback();
+            }
+        }
+        if (board->nowUs % 1000 == 0)
+        {
+            if (onMillisecond)
+            {
+                onMillisecond();
+            }
+            checkLightSleepWake();
+        }
+    }
+    if (realTime)
+    {
+        usleep(us);
+    }
+}
+
+inline uint32_t nextRandom()
+{
+    // xorshift32, so runs are repeatable
+    uint32_t x = board->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return board->randomState = x;
+}
+
+// Powers the board up from scratch, keeping nothing
+inline void powerOn()
+{
+    uint64_t now = board->nowUs;
+    *board = POWER_ON;
+    board->nowUs = now;
+    board->bootUs = now;
+}
+} // namespace host
+
+#endif
@@ -0,0 +1,79 @@
+// Host stand-in for BearSSL's WiFiClientSecure, see ESP8266WiFi.h. There is
+// no TLS: the client speaks plain HTTP to the test's server, and the session
+// only gets an ID so the firmware's resumption bookkeeping has one to keep.
+#ifndef HOST_WIFICLIENTSECURE_H
+#define HOST_WIFICLIENTSECURE_H
+
+#include <ESP8266WiFi.h>
+
+typedef struct
+{
+    unsigned char session_id[32];
+    unsigned char session_id_len;
+    uint16_t version;
+    uint16_t cipher_suite;
+    unsigned char master_secret[48];
+} br_ssl_session_parameters;
+
+#define BR_TLS_RSA_WITH_AES_128_CBC_SHA256 0x003C
+#define BR_TLS_RSA_WITH_AES_128_GCM_SHA256 0x009C
+#define BR_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 0xC02F
+#define BR_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 0xC02B
+#define BR_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 0xCCA8
+#define BR_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 0xCCA9
+
+namespace BearSSL
+{
+// As in the core, only the client may reach the parameters
+class Session
+{
+    friend class WiFiClientSecure;
+
+public:
+    Session() { memset(&params, 0, sizeof(params)); }
+
+private:
+    br_ssl_session_parameters *getSession() { return &params; }
+
+    br_ssl_session_parameters params;
+};
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    using WiFiClient::connect;
+
+    int connect(const char *host, uint16_t port) override
+    {
+        if (!WiFiClient::connect(host, port))
+        {
+            return 0;
+        }
+        if (session && session->getSession()->session_id_len == 0)
+        {
+            br_ssl_session_parameters *params = session->getSession();
+            for (unsigned char &b : params->session_id)
+            {
+                b = host::nextRandom();
+            }
+            params->session_id_len = sizeof(params->session_id);
+        }
+        return 1;
+    }
+
+    void setInsecure() {}
+    void setSession(Session *session) { this->session = session; }
+    void setBufferSizes(int, int) {}
+    bool setCiphers(const uint16_t *, int) { return true; }
+
+    // The server never agrees to a smaller fragment length
+    static bool probeMaxFragmentLength(const char *, uint16_t, uint16_t) { return false; }
+
+private:
+    Session *session = nullptr;
+};
+} // namespace BearSSL
+
+using BearSSL::WiFiClientSecure;
+
+#endif
@@ -0,0 +1,7 @@
+// Host stand-in for the NONOS SDK's gpio.h, see user_interface.h
+#ifndef HOST_GPIO_H
+#define HOST_GPIO_H
+
+#include "user_interface.h"
+
+#endif
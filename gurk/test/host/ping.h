@@ -0,0 +1,15 @@
+/* Host stand-in for the NONOS SDK's ping.h, only so ESP8266Ping.h parses */
+#ifndef HOST_PING_H
+#define HOST_PING_H
+
+struct ping_option
+{
+    unsigned int count;
+    unsigned int ip;
+    unsigned int coarse_time;
+    void *recv_function;
+    void *sent_function;
+    void *reverse;
+};
+
+#endif
@@ -0,0 +1,68 @@
+// Host stand-in for the NONOS SDK's user_interface.h: forced light sleep and
+// the RTC timer, see Arduino.h
+#ifndef HOST_USER_INTERFACE_H
+#define HOST_USER_INTERFACE_H
+
+#include "HostBoard.h"
+
+enum sleep_type
+{
+    NONE_SLEEP_T = 0,
+    LIGHT_SLEEP_T,
+    MODEM_SLEEP_T,
+};
+
+typedef void (*fpm_wakeup_cb)(void);
+
+#define GPIO_ID_PIN(n) (n)
+
+enum GPIO_INT_TYPE
+{
+    GPIO_PIN_INTR_DISABLE = 0,
+    GPIO_PIN_INTR_POSEDGE = 1,
+    GPIO_PIN_INTR_NEGEDGE = 2,
+    GPIO_PIN_INTR_ANYEDGE = 3,
+    GPIO_PIN_INTR_LOLEVEL = 4,
+    GPIO_PIN_INTR_HILEVEL = 5,
+};
+
+inline void wifi_fpm_set_sleep_type(sleep_type) {}
+inline void wifi_fpm_open() {}
+inline void wifi_fpm_close() {}
+
+inline void wifi_fpm_set_wakeup_cb(fpm_wakeup_cb callback)
+{
+    host::lightSleepWakeCallback = callback;
+}
+
+inline int8_t wifi_fpm_do_sleep(uint32_t us)
+{
+    host::lightSleeping = true;
+    host::lightSleepWakeUs = host::board->nowUs + us;
+    return 0;
+}
+
+inline void gpio_pin_wakeup_enable(uint32_t pin, GPIO_INT_TYPE level)
+{
+    host::pinWakeGpio = pin;
+    host::pinWakeLevel = level == GPIO_PIN_INTR_HILEVEL;
+}
+
+inline void gpio_pin_wakeup_disable()
+{
+    host::pinWakeGpio = -1;
+}
+
+// The RTC timer runs in microseconds here, so the calibration is 1.0 in the
+// SDK's Q12 fixed point
+inline uint32_t system_get_rtc_time()
+{
+    return (uint32_t)host::board->nowUs;
+}
+
+inline uint32_t system_rtc_clock_cali_proc()
+{
+    return 1 << 12;
+}
+
+#endif
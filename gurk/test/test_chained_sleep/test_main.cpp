@@ -0,0 +1,106 @@
+#include <unity.h>
+#include "RtcMemory.cpp"
+#include "Energy.cpp"
+#include "Utils.cpp"
+
+// Chained deep sleeps longer than the hardware allows, one boot at a time.
+// Only the last chunk may wake with the radio on, and a wake with the radio
+// off must never count as the end of the sleep.
+
+const uint32_t loadCurrentUa[LOAD_COUNT] = {15000, 55000, 100000, 900, 20, 250000};
+
+const unsigned long BOOT_MS = 600; // from reset to resumeSleep() in setup()
+
+struct Wake
+{
+    bool slept;
+    uint64_t us;
+    RFMode mode;
+};
+
+// The start of setup() after the last sleep: RAM is gone, RTC memory is not
+static Wake boot()
+{
+    host::board->bootUs = host::board->nowUs;
+    rtcClock = {0, 0, 0};
+    delay(BOOT_MS);
+    clockBegin();
+    try
+    {
+        resumeSleep();
+    }
+    catch (const host::DeepSleep &sleep)
+    {
+        return {true, sleep.us, sleep.mode};
+    }
+    return {false, 0, WAKE_RF_DEFAULT};
+}
+
+static void wakeFrom(const Wake &sleep)
+{
+    host::board->nowUs += sleep.us;
+    host::board->resetInfo.reason = REASON_DEEP_SLEEP_AWAKE;
+}
+
+static Wake sleepFor(uint64_t ms)
+{
+    try
+    {
+        go_to_sleep(ms);
+    }
+    catch (const host::DeepSleep &sleep)
+    {
+        return {true, sleep.us, sleep.mode};
+    }
+    return {false, 0, WAKE_RF_DEFAULT};
+}
+
+void setUp()
+{
+    *host::board = host::POWER_ON;
+    clockBegin();
+}
+
+void tearDown()
+{
+}
+
+void test_only_the_last_chunk_wakes_the_radio()
+{
+    uint64_t maxMs = ESP.deepSleepMax() / 1000;
+    Wake sleep = sleepFor(2 * maxMs + 60000);
+    int chunks = 0;
+    while (sleep.slept)
+    {
+        chunks++;
+        wakeFrom(sleep);
+        Wake next = boot();
+        TEST_ASSERT_EQUAL(next.slept ? WAKE_RF_DISABLED : WAKE_RF_DEFAULT, sleep.mode);
+        sleep = next;
+    }
+    TEST_ASSERT_EQUAL(3, chunks);
+}
+
+void test_a_radio_off_wake_inside_the_boot_time_is_not_the_end()
+{
+    // The first chunk leaves just over the slack, so it sleeps with the
+    // radio off, and booting uses up what was left
+    Wake sleep = sleepFor(ESP.deepSleepMax() / 1000 + SLEEP_SLACK_MS + 5);
+    TEST_ASSERT_EQUAL(WAKE_RF_DISABLED, sleep.mode);
+
+    wakeFrom(sleep);
+    Wake next = boot();
+    TEST_ASSERT_TRUE_MESSAGE(next.slept, "woke with the radio off and stayed up");
+    TEST_ASSERT_EQUAL(WAKE_RF_DEFAULT, next.mode);
+
+    wakeFrom(next);
+    TEST_ASSERT_FALSE(boot().slept);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_only_the_last_chunk_wakes_the_radio);
+    RUN_TEST(test_a_radio_off_wake_inside_the_boot_time_is_not_the_end);
+    return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include <unity.h>
+#include "DebounceFilter.cpp"
+
+// Switch waveforms as the timer sees them, one character per 1 ms sample.
+// Contact bounce on the valve microswitch lasts a few ms either way.
+static const char *CLEAN_PRESS = "11111"
+                                 "00000000";
+static const char *BOUNCY_PRESS = "1111111111"
+                                  "01001011"
+                                  "000000000000";
+static const char *GLITCHES = "0000000"
+                              "1"
+                              "00"
+                              "11"
+                              "000"
+                              "1111"
+                              "00000000";
+static const char *BOUNCY_RELEASE = "000000000"
+                                    "1011010111"
+                                    "1111111111";
+static const char *GLITCH_THEN_PRESS = "111111"
+                                       "0"
+                                       "111111111111111"
+                                       "000000000";
+
+struct Edge
+{
+    uint32_t sample; // count when the output changed
+    uint32_t changedAt;
+    uint8_t level;
+};
+
+struct Run
+{
+    Edge edges[8];
+    int count = 0;
+};
+
+static Run feed(DebounceFilter &filter, const char *wave)
+{
+    Run run;
+    for (const char *c = wave; *c; c++)
+    {
+        if (debounceSample(filter, *c == '1') && run.count < 8)
+        {
+            run.edges[run.count++] = {filter.count, filter.changedAt, filter.level};
+        }
+    }
+    return run;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void test_clean_edge_after_the_stable_time()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_STABLE_TIME, 5, 1);
+    Run run = feed(filter, CLEAN_PRESS);
+
+    TEST_ASSERT_EQUAL(1, run.count);
+    TEST_ASSERT_EQUAL(0, run.edges[0].level);
+    TEST_ASSERT_EQUAL(10, run.edges[0].sample);
+    TEST_ASSERT_EQUAL(6, run.edges[0].changedAt);
+}
+
+static void test_bouncy_press_gives_one_edge_stamped_at_the_last_bounce()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_STABLE_TIME, 5, 1);
+    Run run = feed(filter, BOUNCY_PRESS);
+
+    TEST_ASSERT_EQUAL(1, run.count);
+    TEST_ASSERT_EQUAL(0, run.edges[0].level);
+    TEST_ASSERT_EQUAL(23, run.edges[0].sample);
+    TEST_ASSERT_EQUAL(19, run.edges[0].changedAt);
+    TEST_ASSERT_EQUAL(7, filter.rawChanges); // six of them bounces
+}
+
+static void test_glitches_shorter_than_the_stable_time_are_dropped()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_STABLE_TIME, 5, 0);
+    Run run = feed(filter, GLITCHES);
+
+    TEST_ASSERT_EQUAL(0, run.count);
+    TEST_ASSERT_EQUAL(0, filter.level);
+    TEST_ASSERT_FALSE(filter.pending);
+}
+
+static void test_majority_vote_rides_out_a_bouncy_release()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_MAJORITY, 9, 0);
+    Run run = feed(filter, BOUNCY_RELEASE);
+
+    TEST_ASSERT_EQUAL(1, run.count);
+    TEST_ASSERT_EQUAL(1, run.edges[0].level);
+    TEST_ASSERT_EQUAL(17, run.edges[0].sample);
+    TEST_ASSERT_EQUAL(17, run.edges[0].changedAt);
+}
+
+static void test_majority_glitch_does_not_backdate_the_next_edge()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_MAJORITY, 5, 1);
+    Run run = feed(filter, GLITCH_THEN_PRESS);
+
+    TEST_ASSERT_EQUAL(1, run.count);
+    TEST_ASSERT_EQUAL(25, run.edges[0].sample);
+    TEST_ASSERT_EQUAL(23, run.edges[0].changedAt); // not the glitch at 7
+}
+
+static void test_sample_count_is_clamped()
+{
+    DebounceFilter filter;
+    debounceReset(filter, DEBOUNCE_STABLE_TIME, 0, 1);
+    TEST_ASSERT_EQUAL(1, filter.samples);
+    debounceReset(filter, DEBOUNCE_MAJORITY, 40, 1);
+    TEST_ASSERT_EQUAL(32, filter.samples);
+    TEST_ASSERT_EQUAL(0, feed(filter, "0000000000000000").count); // 16 of 32 is no majority
+    TEST_ASSERT_EQUAL(1, feed(filter, "0").count);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_clean_edge_after_the_stable_time);
+    RUN_TEST(test_bouncy_press_gives_one_edge_stamped_at_the_last_bounce);
+    RUN_TEST(test_glitches_shorter_than_the_stable_time_are_dropped);
+    RUN_TEST(test_majority_vote_rides_out_a_bouncy_release);
+    RUN_TEST(test_majority_glitch_does_not_backdate_the_next_edge);
+    RUN_TEST(test_sample_count_is_clamped);
+    return UNITY_END();
+}
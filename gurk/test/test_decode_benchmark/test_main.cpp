@@ -0,0 +1,154 @@
+#include <unity.h>
+#include <chrono>
+#include "RtcMemory.cpp"
+#include "Utils.cpp"
+#include "Energy.cpp"
+#include "WakeTimings.cpp"
+#include "ServerSession.cpp"
+#include "HTTPHandler.cpp"
+
+// Compares the get_device_variables body as MessagePack and as JSON: bytes on
+// the wire, and the time to decode it with the firmware's filter and document
+// size. The times are the host's, so only the ratio says anything about the
+// chip; there the decode of each fetch is logged as PHASE_DECODE.
+
+const uint32_t loadCurrentUa[LOAD_COUNT] = {15000, 55000, 100000, 900, 20, 250000};
+
+const int ITERATIONS = 20000;
+
+// A body held in memory, read the way WiFiClient hands it to ArduinoJson
+class PayloadStream : public Stream
+{
+public:
+    PayloadStream(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+    void rewind() { position = 0; }
+    int available() override { return size - position; }
+    int read() override { return position < size ? data[position++] : -1; }
+    int peek() override { return position < size ? data[position] : -1; }
+    size_t readBytes(char *buffer, size_t length) override
+    {
+        size_t n = std::min(length, size - position);
+        memcpy(buffer, data + position, n);
+        position += n;
+        return n;
+    }
+    size_t write(uint8_t) override { return 0; }
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t position = 0;
+};
+
+struct Payload
+{
+    uint8_t data[256];
+    size_t size;
+};
+
+static Payload msgpackBody;
+static Payload jsonBody;
+
+// What app.py sends: msgpack.packb() keeps the order of its arguments and
+// jsonify() sorts the keys
+static void encodeBodies()
+{
+    StaticJsonDocument<512> doc;
+    doc["time_until_watering"] = 31337;
+    doc["watering_time"] = 5;
+    doc["sleep_time"] = 14400;
+    doc["watering_volume"] = 0;
+    doc["current_time"] = "2026-10-17 05:17:03 CEST";
+    doc["next_watering_time"] = "2026-10-17 14:00:00 CEST";
+    msgpackBody.size = serializeMsgPack(doc, msgpackBody.data, sizeof(msgpackBody.data));
+
+    StaticJsonDocument<512> sorted;
+    sorted["current_time"] = doc["current_time"];
+    sorted["next_watering_time"] = doc["next_watering_time"];
+    sorted["sleep_time"] = doc["sleep_time"];
+    sorted["time_until_watering"] = doc["time_until_watering"];
+    sorted["watering_time"] = doc["watering_time"];
+    sorted["watering_volume"] = doc["watering_volume"];
+    jsonBody.size = serializeJson(sorted, (char *)jsonBody.data, sizeof(jsonBody.data));
+}
+
+// decodeDeviceVariables() without its logging, timed over ITERATIONS
+static double decodeNs(const Payload &payload, bool msgpack)
+{
+    PayloadStream body(payload.data, payload.size);
+    StaticJsonDocument<JSON_OBJECT_SIZE(4)> filter;
+    filter["time_until_watering"] = true;
+    filter["watering_time"] = true;
+    filter["sleep_time"] = true;
+    filter["watering_volume"] = true;
+
+    int32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        body.rewind();
+        StaticJsonDocument<VARIABLES_DOC_SIZE> doc;
+        DeserializationError error = msgpack ? deserializeMsgPack(doc, body, DeserializationOption::Filter(filter))
+                                             : deserializeJson(doc, body, DeserializationOption::Filter(filter));
+        TEST_ASSERT_FALSE(error || doc.overflowed());
+        checksum += doc["sleep_time"].as<int32_t>();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    TEST_ASSERT_EQUAL_INT32((int32_t)(14400u * ITERATIONS), checksum);
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_both_formats_decode_to_the_same_variables()
+{
+    DeviceVariables fromMsgpack = {};
+    DeviceVariables fromJson = {};
+    PayloadStream msgpack(msgpackBody.data, msgpackBody.size);
+    PayloadStream json(jsonBody.data, jsonBody.size);
+    TEST_ASSERT_TRUE(decodeDeviceVariables(msgpack, true, fromMsgpack));
+    TEST_ASSERT_TRUE(decodeDeviceVariables(json, false, fromJson));
+
+    TEST_ASSERT_EQUAL_INT32(31337, fromMsgpack.time_until_watering);
+    TEST_ASSERT_EQUAL_INT32(fromJson.time_until_watering, fromMsgpack.time_until_watering);
+    TEST_ASSERT_EQUAL_UINT32(fromJson.watering_time, fromMsgpack.watering_time);
+    TEST_ASSERT_EQUAL_INT32(fromJson.sleep_time, fromMsgpack.sleep_time);
+    TEST_ASSERT_EQUAL_FLOAT(fromJson.watering_volume, fromMsgpack.watering_volume);
+}
+
+void test_msgpack_body_is_smaller()
+{
+    printf("Body: msgpack %zu bytes, json %zu bytes\n", msgpackBody.size, jsonBody.size);
+    TEST_ASSERT_LESS_THAN(jsonBody.size, msgpackBody.size);
+}
+
+void test_msgpack_decodes_no_slower()
+{
+    // Warm the caches before either is timed
+    decodeNs(msgpackBody, true);
+    decodeNs(jsonBody, false);
+
+    double msgpackNs = decodeNs(msgpackBody, true);
+    double jsonNs = decodeNs(jsonBody, false);
+    printf("Decode: msgpack %.0f ns, json %.0f ns (%d iterations)\n", msgpackNs, jsonNs, ITERATIONS);
+    // Loose, so a busy machine does not fail the run
+    TEST_ASSERT_TRUE(msgpackNs < jsonNs * 1.5);
+}
+
+int main()
+{
+    encodeBodies();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_both_formats_decode_to_the_same_variables);
+    RUN_TEST(test_msgpack_body_is_smaller);
+    RUN_TEST(test_msgpack_decodes_no_slower);
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+#include <unity.h>
+#include "MotorController.cpp"
+
+// A valve on a fake motor: the switch reads LOW over the open stretch of the
+// travel and HIGH elsewhere, and the switch cuts the motor the moment it
+// reaches the level it was started for, as the limit switch interrupt does.
+class FakeMotorIo : public MotorIo
+{
+public:
+    unsigned long clock = 0;
+    unsigned long position = 0; // ms of travel from rest, wraps at TRAVEL_CYCLE
+    bool running = false;
+    bool stuck = false;
+    int stopAt = MOTOR_NO_SWITCH;
+    int starts = 0;
+    int stops = 0;
+
+    static const unsigned long OPEN_FROM = 2000;
+    static const unsigned long TRAVEL_CYCLE = 4000;
+
+    int readSwitch() override { return position >= OPEN_FROM ? 0 : 1; }
+
+    void startMotor(int level) override
+    {
+        running = true;
+        stopAt = level;
+        starts++;
+    }
+
+    void stopMotor() override
+    {
+        running = false;
+        stops++;
+    }
+
+    bool motorRunning() override { return running; }
+    unsigned long now() override { return clock; }
+
+    void advance(unsigned long ms)
+    {
+        for (unsigned long i = 0; i < ms; i++)
+        {
+            clock++;
+            if (running && !stuck)
+            {
+                position = (position + 1) % TRAVEL_CYCLE;
+                if (stopAt != MOTOR_NO_SWITCH && readSwitch() == stopAt)
+                {
+                    running = false;
+                }
+            }
+        }
+    }
+};
+
+static FakeMotorIo io;
+
+void setUp()
+{
+    io = FakeMotorIo();
+}
+
+void tearDown()
+{
+}
+
+// Ticks the controller every 10 ms until it is done, returns the ms it took
+static unsigned long runToEnd(MotorController &motor)
+{
+    unsigned long startedAt = io.clock;
+    while (motor.tick())
+    {
+        io.advance(10);
+    }
+    return io.clock - startedAt;
+}
+
+static void test_open_runs_to_the_open_switch()
+{
+    MotorController motor(io, 10000, 0);
+    TEST_ASSERT_TRUE(motor.open());
+    TEST_ASSERT_EQUAL(MOTOR_OPENING, motor.state());
+    TEST_ASSERT_TRUE(motor.busy());
+    TEST_ASSERT_FALSE(motor.close()); // busy
+
+    runToEnd(motor);
+    TEST_ASSERT_EQUAL(MOTOR_OPEN, motor.state());
+    TEST_ASSERT_EQUAL(0, io.readSwitch());
+    TEST_ASSERT_UINT32_WITHIN(10, 2000, motor.travelTime());
+    TEST_ASSERT_EQUAL(1, io.stops);
+}
+
+static void test_close_runs_back_to_rest()
+{
+    io.position = FakeMotorIo::OPEN_FROM;
+    MotorController motor(io, 10000, 0);
+    TEST_ASSERT_TRUE(motor.close());
+    TEST_ASSERT_EQUAL(MOTOR_CLOSING, motor.state());
+    TEST_ASSERT_EQUAL(1, motor.targetLevel());
+
+    runToEnd(motor);
+    TEST_ASSERT_EQUAL(MOTOR_CLOSED, motor.state());
+    TEST_ASSERT_EQUAL(1, io.readSwitch());
+    TEST_ASSERT_UINT32_WITHIN(10, 2000, motor.travelTime());
+}
+
+static void test_open_when_already_open_does_not_start_the_motor()
+{
+    io.position = FakeMotorIo::OPEN_FROM + 500;
+    MotorController motor(io, 10000, 0);
+    TEST_ASSERT_TRUE(motor.open());
+    TEST_ASSERT_EQUAL(MOTOR_OPEN, motor.state());
+    TEST_ASSERT_FALSE(motor.tick());
+    TEST_ASSERT_EQUAL(0, io.starts);
+    TEST_ASSERT_EQUAL(0, motor.travelTime());
+}
+
+static void test_missing_switch_times_out_to_fault()
+{
+    io.stuck = true;
+    MotorController motor(io, 3000, 0);
+    motor.open();
+    unsigned long took = runToEnd(motor);
+
+    TEST_ASSERT_EQUAL(MOTOR_FAULT, motor.state());
+    TEST_ASSERT_FALSE(io.running);
+    TEST_ASSERT_EQUAL(1, io.stops);
+    TEST_ASSERT_UINT32_WITHIN(10, 3000, took);
+    TEST_ASSERT_EQUAL(0, motor.targetLevel()); // what the fault event reports
+}
+
+static void test_timeout_applies_from_the_next_travel()
+{
+    MotorController motor(io, 10000, 0);
+    motor.setTimeout(1000);
+    motor.open(); // needs 2000 ms
+    runToEnd(motor);
+    TEST_ASSERT_EQUAL(MOTOR_FAULT, motor.state());
+
+    // A fault does not stop the next travel from starting
+    motor.setTimeout(10000);
+    TEST_ASSERT_TRUE(motor.open());
+    runToEnd(motor);
+    TEST_ASSERT_EQUAL(MOTOR_OPEN, motor.state());
+}
+
+static void test_nudge_runs_for_its_time_and_ignores_the_switch()
+{
+    MotorController motor(io, 10000, 0);
+    TEST_ASSERT_TRUE(motor.nudge(5000));
+    TEST_ASSERT_EQUAL(MOTOR_NUDGING, motor.state());
+    TEST_ASSERT_EQUAL(MOTOR_NO_SWITCH, io.stopAt);
+
+    unsigned long took = runToEnd(motor);
+    TEST_ASSERT_EQUAL(MOTOR_IDLE, motor.state()); // position unknown afterwards
+    TEST_ASSERT_UINT32_WITHIN(10, 5000, took);
+    TEST_ASSERT_EQUAL(5000 % FakeMotorIo::TRAVEL_CYCLE, io.position); // ran straight past the open switch
+    TEST_ASSERT_EQUAL(1, io.stops);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_open_runs_to_the_open_switch);
+    RUN_TEST(test_close_runs_back_to_rest);
+    RUN_TEST(test_open_when_already_open_does_not_start_the_motor);
+    RUN_TEST(test_missing_switch_times_out_to_fault);
+    RUN_TEST(test_timeout_applies_from_the_next_travel);
+    RUN_TEST(test_nudge_runs_for_its_time_and_ignores_the_switch);
+    return UNITY_END();
+}
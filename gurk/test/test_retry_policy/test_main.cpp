@@ -0,0 +1,203 @@
+#include <unity.h>
+#include "RtcMemory.cpp"
+#include "RetryPolicy.cpp"
+
+// Replays server outages against the old fixed errorTimeout retry and the
+// back-off in RetryPolicy, and reports what each costs in radio-on time. The
+// device is modelled the way main.cpp drives it: every attempt brings WiFi
+// up and sends one request, and a failure waits before the next attempt.
+
+const int errorTimeout = 20000;
+
+const unsigned long CONNECT_MS = 3000;        // association and DHCP
+const unsigned long FAILED_REQUEST_MS = 5000; // REQUEST_TIMEOUT, the server not answering
+const unsigned long GOOD_REQUEST_MS = 1500;
+
+static unsigned long radioOnThisWake = 0;
+
+unsigned long radioOnTime()
+{
+    return radioOnThisWake;
+}
+
+struct Outage
+{
+    const char *name;
+    uint64_t ms; // the server is down from the first attempt for this long
+};
+
+const Outage OUTAGES[] = {
+    {"1 min blip", 60000},
+    {"10 min", 600000},
+    {"2 h", 7200000},
+    {"12 h", 43200000},
+};
+
+struct Replay
+{
+    uint32_t attempts;
+    uint32_t wakes;         // deep sleeps taken between attempts
+    uint64_t radioMs;       // radio on, over the whole outage
+    uint64_t awakeWaitMs;   // waited with the CPU up
+    uint64_t longestAwake;  // longest single wait with the CPU up
+    uint64_t recoveredAfter; // from the end of the outage to the first good request
+};
+
+// One attempt at now: the radio comes up, the request goes out, and the
+// result depends on whether the outage is over
+static bool attempt(const Outage &outage, uint64_t &now, Replay &replay)
+{
+    replay.attempts++;
+    now += CONNECT_MS;
+    bool up = now >= outage.ms;
+    unsigned long radioMs = CONNECT_MS + (up ? GOOD_REQUEST_MS : FAILED_REQUEST_MS);
+    now += radioMs - CONNECT_MS;
+    replay.radioMs += radioMs;
+    radioOnThisWake += radioMs;
+    if (up)
+    {
+        replay.recoveredAfter = now - outage.ms;
+    }
+    return up;
+}
+
+static void waitAwake(uint64_t ms, uint64_t &now, Replay &replay)
+{
+    now += ms;
+    replay.awakeWaitMs += ms;
+    replay.longestAwake = max(replay.longestAwake, ms);
+}
+
+// Before RetryPolicy: WiFi off, errorTimeout awake, reconnect, forever
+static Replay replayFixed(const Outage &outage)
+{
+    Replay replay = {};
+    uint64_t now = 0;
+    while (!attempt(outage, now, replay))
+    {
+        waitAwake(errorTimeout, now, replay);
+    }
+    return replay;
+}
+
+// A deep sleep clears RAM, which for RetryPolicy is the per-wake budget
+static void deepSleep(uint64_t ms, uint64_t &now, Replay &replay)
+{
+    now += ms;
+    replay.wakes++;
+    retryLoaded = false;
+    wakeAttempts = 0;
+    radioOnThisWake = 0;
+}
+
+// retryAfterFailure() in main.cpp
+static Replay replayBackoff(const Outage &outage)
+{
+    Replay replay = {};
+    uint64_t now = 0;
+    rtcClear(RTC_SLOT_RETRY);
+    deepSleep(0, now, replay);
+    replay.wakes = 0;
+
+    while (!attempt(outage, now, replay))
+    {
+        unsigned long retryDelay = retryFailed();
+        if (retryBudgetSpent() || retryDelay >= DEEP_SLEEP_MIN_WAIT)
+        {
+            deepSleep(retryDelay, now, replay);
+        }
+        else
+        {
+            waitAwake(retryDelay, now, replay);
+        }
+    }
+    retrySucceeded();
+    return replay;
+}
+
+static void report(const char *outage, const char *policy, const Replay &replay)
+{
+    printf("%-10s  %-8s  %5u attempts  %4u wakes  radio %7.1f s  awake %7.1f s  back %6.1f s after\n",
+           outage, policy, replay.attempts, replay.wakes, replay.radioMs / 1000.0, replay.awakeWaitMs / 1000.0,
+           replay.recoveredAfter / 1000.0);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_report_radio_time_per_policy()
+{
+    for (const Outage &outage : OUTAGES)
+    {
+        report(outage.name, "fixed", replayFixed(outage));
+        report(outage.name, "backoff", replayBackoff(outage));
+    }
+}
+
+void test_backoff_saves_radio_time_in_long_outages()
+{
+    for (const Outage &outage : OUTAGES)
+    {
+        if (outage.ms < 600000)
+        {
+            continue;
+        }
+        Replay fixed = replayFixed(outage);
+        Replay backoff = replayBackoff(outage);
+        TEST_ASSERT_LESS_THAN_MESSAGE(fixed.radioMs / 2, backoff.radioMs, outage.name);
+    }
+}
+
+void test_backoff_never_waits_long_awake()
+{
+    for (const Outage &outage : OUTAGES)
+    {
+        Replay backoff = replayBackoff(outage);
+        TEST_ASSERT_LESS_THAN_MESSAGE(DEEP_SLEEP_MIN_WAIT, backoff.longestAwake, outage.name);
+        TEST_ASSERT_LESS_THAN_MESSAGE(RETRY_WAKE_ATTEMPTS * 2, backoff.attempts / (backoff.wakes + 1), outage.name);
+    }
+}
+
+void test_backoff_finds_the_server_within_the_cap()
+{
+    for (const Outage &outage : OUTAGES)
+    {
+        Replay backoff = replayBackoff(outage);
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(RETRY_MAX_DELAY + CONNECT_MS + FAILED_REQUEST_MS, backoff.recoveredAfter, outage.name);
+    }
+}
+
+void test_failures_carry_over_deep_sleep()
+{
+    rtcClear(RTC_SLOT_RETRY);
+    uint64_t now = 0;
+    Replay replay = {};
+    deepSleep(0, now, replay);
+
+    unsigned long first = retryFailed();
+    deepSleep(first, now, replay);
+    unsigned long second = retryFailed();
+    TEST_ASSERT_EQUAL_UINT16(2, retryState.failures);
+    TEST_ASSERT_GREATER_OR_EQUAL(errorTimeout, second); // the second back-off is 2 * errorTimeout, half of it fixed
+    TEST_ASSERT_LESS_OR_EQUAL(errorTimeout * 2, second);
+
+    retrySucceeded();
+    deepSleep(0, now, replay);
+    TEST_ASSERT_LESS_OR_EQUAL(errorTimeout, retryFailed());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_report_radio_time_per_policy);
+    RUN_TEST(test_backoff_saves_radio_time_in_long_outages);
+    RUN_TEST(test_backoff_never_waits_long_awake);
+    RUN_TEST(test_backoff_finds_the_server_within_the_cap);
+    RUN_TEST(test_failures_carry_over_deep_sleep);
+    return UNITY_END();
+}
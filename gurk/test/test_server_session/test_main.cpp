@@ -0,0 +1,435 @@
+#include <unity.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "RtcMemory.cpp"
+#include "Utils.cpp"
+#include "Energy.cpp"
+#include "WakeTimings.cpp"
+#include "ServerSession.cpp"
+#include "HTTPHandler.cpp"
+
+// ServerSession and the device variables fetch over real sockets, against a
+// stand-in for hemsida/app.py forked off for each test. The host
+// WiFiClientSecure speaks plain HTTP and every connect goes to the stand-in's
+// port. Waits take real time here, so the request timeout is a real one.
+//
+// With hemsida/app.py running, GURK_STANDIN_PORT=5001 also fetches from it.
+
+const uint32_t loadCurrentUa[LOAD_COUNT] = {15000, 55000, 100000, 900, 20, 250000};
+
+const char *VARIABLES_URL = "https://gurk.test/get_device_variables";
+const char *EVENTS_URL = "https://gurk.test/log_events";
+const char *SCHEDULE_ETAG = "\"3f0c9e1a52b7d864\"";
+
+enum StandInMode
+{
+    STANDIN_KEEP_ALIVE,
+    STANDIN_HTTP10,    // Werkzeug's default: HTTP/1.0, a connection per request
+    STANDIN_CHUNKED,   // bodies in chunked transfer encoding
+    STANDIN_JSON_ONLY, // an older server: JSON answers, 415 for MessagePack posts
+    STANDIN_SLOW,      // answers after STANDIN_DELAY_MS
+    STANDIN_SILENT,    // reads requests and never answers
+    STANDIN_NEW_FIELD, // a newer server: one more field, with a long name
+};
+
+const unsigned long STANDIN_DELAY_MS = 300;
+
+// What the stand-in saw, shared with the test
+struct StandInLog
+{
+    int connections;
+    int requests;
+    char lastContentType[40];
+};
+
+static StandInLog *standInLog;
+static pid_t standIn = 0;
+static int listener = -1;
+
+// Reads one request off the connection: the headers that matter and the
+// body. False once the client has closed it.
+static bool readRequest(int fd, char *method, char *path, char *accept, char *contentType, bool &conditional)
+{
+    char head[1024];
+    size_t length = 0;
+    while (length < sizeof(head) - 1 && (length < 4 || memcmp(head + length - 4, "\r\n\r\n", 4) != 0))
+    {
+        if (recv(fd, head + length, 1, 0) != 1)
+        {
+            return false;
+        }
+        length++;
+    }
+    head[length] = '\0';
+
+    sscanf(head, "%7s %63s", method, path);
+    accept[0] = contentType[0] = '\0';
+    conditional = false;
+    long bodyLength = 0;
+    for (char *line = strstr(head, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, "Accept: ", 8) == 0)
+        {
+            sscanf(line + 10, "%63[^\r]", accept);
+        }
+        else if (strncasecmp(line + 2, "Content-Type: ", 14) == 0)
+        {
+            sscanf(line + 16, "%39[^\r]", contentType);
+        }
+        else if (strncasecmp(line + 2, "Content-Length: ", 16) == 0)
+        {
+            bodyLength = atol(line + 18);
+        }
+        else if (strncasecmp(line + 2, "If-None-Match: ", 15) == 0)
+        {
+            conditional = strncmp(line + 17, SCHEDULE_ETAG, strlen(SCHEDULE_ETAG)) == 0;
+        }
+    }
+
+    char body[512];
+    while (bodyLength > 0)
+    {
+        ssize_t n = recv(fd, body, min((long)sizeof(body), bodyLength), 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        bodyLength -= n;
+    }
+    return true;
+}
+
+// A field the device does not know, as long as a name it has to skip can be
+const char *NEW_FIELD = "watering_schedule_last_changed_from_the_website_";
+
+// The fields app.py sends, the last two only for people reading the logs
+static size_t scheduleBody(StandInMode mode, bool msgpack, uint8_t *body, size_t size)
+{
+    StaticJsonDocument<256> doc;
+    doc["time_until_watering"] = 7200;
+    doc["watering_time"] = 5;
+    doc["sleep_time"] = 14400;
+    doc["watering_volume"] = 0;
+    doc["current_time"] = "2026-10-17 12:00:00 CEST";
+    doc["next_watering_time"] = "2026-10-17 14:00:00 CEST";
+    if (mode == STANDIN_NEW_FIELD)
+    {
+        doc[NEW_FIELD] = "2026-10-17 09:41:00 CEST";
+    }
+    return msgpack ? serializeMsgPack(doc, body, size) : serializeJson(doc, body, size);
+}
+
+static void respond(int fd, StandInMode mode, int status, const char *contentType, const uint8_t *body, size_t size)
+{
+    char head[512];
+    int length = snprintf(head, sizeof(head), "%s %d %s\r\nDate: Sat, 17 Oct 2026 10:00:00 GMT\r\nETag: %s\r\n",
+                          mode == STANDIN_HTTP10 ? "HTTP/1.0" : "HTTP/1.1", status, status == 200 ? "OK" : "",
+                          SCHEDULE_ETAG);
+    if (status != 304)
+    {
+        length += snprintf(head + length, sizeof(head) - length, "Content-Type: %s\r\n", contentType);
+        length += mode == STANDIN_CHUNKED ? snprintf(head + length, sizeof(head) - length, "Transfer-Encoding: chunked\r\n")
+                                          : snprintf(head + length, sizeof(head) - length, "Content-Length: %u\r\n", (unsigned)size);
+    }
+    length += snprintf(head + length, sizeof(head) - length, "\r\n");
+    send(fd, head, length, MSG_NOSIGNAL);
+    if (status == 304)
+    {
+        return;
+    }
+
+    if (mode == STANDIN_CHUNKED)
+    {
+        // Two chunks, so the client has to find its way across a boundary
+        size_t first = size / 2;
+        char chunk[16];
+        send(fd, chunk, snprintf(chunk, sizeof(chunk), "%zx\r\n", first), MSG_NOSIGNAL);
+        send(fd, body, first, MSG_NOSIGNAL);
+        send(fd, chunk, snprintf(chunk, sizeof(chunk), "\r\n%zx;x=1\r\n", size - first), MSG_NOSIGNAL);
+        send(fd, body + first, size - first, MSG_NOSIGNAL);
+        send(fd, "\r\n0\r\n\r\n", 7, MSG_NOSIGNAL);
+    }
+    else
+    {
+        send(fd, body, size, MSG_NOSIGNAL);
+    }
+}
+
+static void serve(int fd, StandInMode mode)
+{
+    char method[8], path[64], accept[64], contentType[40];
+    bool conditional;
+    while (readRequest(fd, method, path, accept, contentType, conditional))
+    {
+        standInLog->requests++;
+        if (mode == STANDIN_SILENT)
+        {
+            continue;
+        }
+        if (mode == STANDIN_SLOW)
+        {
+            usleep(STANDIN_DELAY_MS * 1000);
+        }
+
+        uint8_t body[256];
+        if (strcmp(path, "/get_device_variables") == 0)
+        {
+            bool msgpack = mode != STANDIN_JSON_ONLY && strncmp(accept, "application/msgpack", 19) == 0;
+            size_t size = scheduleBody(mode, msgpack, body, sizeof(body));
+            respond(fd, mode, conditional ? 304 : 200, msgpack ? "application/msgpack" : "application/json", body, size);
+        }
+        else if (mode == STANDIN_JSON_ONLY && strcmp(contentType, "application/msgpack") == 0)
+        {
+            respond(fd, mode, 415, "text/html", (const uint8_t *)"Unsupported", 11);
+        }
+        else
+        {
+            strncpy(standInLog->lastContentType, contentType, sizeof(standInLog->lastContentType) - 1);
+            respond(fd, mode, 200, "text/html", (const uint8_t *)"OK", 2);
+        }
+
+        if (mode == STANDIN_HTTP10)
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void startStandIn(StandInMode mode)
+{
+    fflush(stdout);
+    standIn = fork();
+    if (standIn == 0)
+    {
+        for (;;)
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                standInLog->connections++;
+                serve(fd, mode);
+            }
+        }
+    }
+}
+
+static double realMs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+static void checkSchedule(const DeviceVariables &vars)
+{
+    TEST_ASSERT_EQUAL_INT32(7200, vars.time_until_watering);
+    TEST_ASSERT_EQUAL_UINT32(5, vars.watering_time);
+    TEST_ASSERT_EQUAL_INT32(14400, vars.sleep_time);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0, vars.watering_volume);
+}
+
+void setUp()
+{
+    *host::board = host::POWER_ON;
+    memset(standInLog, 0, sizeof(*standInLog));
+    clockBegin();
+}
+
+void tearDown()
+{
+    serverSession.close();
+    if (standIn > 0)
+    {
+        kill(standIn, SIGKILL);
+        waitpid(standIn, nullptr, 0);
+        standIn = 0;
+    }
+}
+
+void test_fetches_the_schedule_as_msgpack()
+{
+    startStandIn(STANDIN_KEEP_ALIVE);
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    checkSchedule(vars);
+    TEST_ASSERT_EQUAL_STRING("application/msgpack", serverSession.contentType());
+}
+
+void test_falls_back_to_json()
+{
+    startStandIn(STANDIN_JSON_ONLY);
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    checkSchedule(vars);
+
+    StaticJsonDocument<64> doc;
+    doc["dropped"] = 0;
+    TEST_ASSERT_EQUAL(200, postDocument(EVENTS_URL, doc));
+    TEST_ASSERT_EQUAL_STRING("application/json", standInLog->lastContentType);
+}
+
+// A document with a string of length bytes, about that much on the wire
+static void fillDocument(JsonDocument &doc, char *text, size_t length)
+{
+    memset(text, 'x', length);
+    text[length] = '\0';
+    doc["text"] = (const char *)text;
+}
+
+void test_does_not_send_a_body_that_does_not_fit()
+{
+    startStandIn(STANDIN_JSON_ONLY);
+    static char text[400];
+    StaticJsonDocument<64> doc;
+
+    fillDocument(doc, text, 390);
+    TEST_ASSERT_EQUAL(HTTPC_ERROR_TOO_LESS_RAM, postDocument(EVENTS_URL, doc));
+    TEST_ASSERT_EQUAL(0, standInLog->requests);
+
+    // Fits as MessagePack, but not as the JSON the server wants instead
+    fillDocument(doc, text, 375);
+    TEST_ASSERT_EQUAL(HTTPC_ERROR_TOO_LESS_RAM, postDocument(EVENTS_URL, doc));
+    TEST_ASSERT_EQUAL(1, standInLog->requests);
+
+    fillDocument(doc, text, 360);
+    TEST_ASSERT_EQUAL(200, postDocument(EVENTS_URL, doc));
+    TEST_ASSERT_EQUAL_STRING("application/json", standInLog->lastContentType);
+}
+
+void test_skips_a_field_it_does_not_know()
+{
+    startStandIn(STANDIN_NEW_FIELD);
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    checkSchedule(vars);
+}
+
+void test_unchanged_schedule_comes_from_the_cache_over_the_same_connection()
+{
+    startStandIn(STANDIN_KEEP_ALIVE);
+    DeviceVariables first = {};
+    DeviceVariables second = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, first));
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, second));
+
+    TEST_ASSERT_EQUAL(HTTP_CODE_NOT_MODIFIED, serverSession.status());
+    checkSchedule(second);
+    TEST_ASSERT_EQUAL(2, standInLog->requests);
+    TEST_ASSERT_EQUAL(1, standInLog->connections);
+}
+
+void test_reconnects_after_an_http10_response()
+{
+    startStandIn(STANDIN_HTTP10);
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    checkSchedule(vars);
+    TEST_ASSERT_EQUAL(2, standInLog->connections);
+}
+
+void test_reads_a_chunked_body_and_keeps_the_connection()
+{
+    startStandIn(STANDIN_CHUNKED);
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(fetchDeviceVariables(VARIABLES_URL, vars));
+    checkSchedule(vars);
+
+    StaticJsonDocument<64> doc;
+    doc["dropped"] = 0;
+    TEST_ASSERT_EQUAL(200, postDocument(EVENTS_URL, doc));
+    TEST_ASSERT_EQUAL(1, standInLog->connections);
+}
+
+// The caller gets control back between ticks while the server thinks, which
+// is what lets the motor be serviced during a request
+void test_ticks_return_while_the_server_is_slow()
+{
+    startStandIn(STANDIN_SLOW);
+    TEST_ASSERT_TRUE(requestDeviceVariables(VARIABLES_URL));
+    TEST_ASSERT_TRUE(serverSession.tick()); // connects and sends
+    TEST_ASSERT_EQUAL(REQUEST_WAITING, serverSession.state());
+
+    int ticks = 0;
+    double longestTick = 0;
+    double started = realMs();
+    bool busy = true;
+    while (busy)
+    {
+        double before = realMs();
+        busy = serverSession.tick();
+        longestTick = max(longestTick, realMs() - before);
+        ticks++;
+        delay(1); // the motor's turn
+    }
+    double took = realMs() - started;
+
+    DeviceVariables vars = {};
+    TEST_ASSERT_TRUE(receiveDeviceVariables(vars));
+    checkSchedule(vars);
+    TEST_ASSERT_GREATER_OR_EQUAL(STANDIN_DELAY_MS * 0.8, took);
+    TEST_ASSERT_GREATER_THAN(50, ticks);
+    TEST_ASSERT_LESS_THAN(20, longestTick);
+}
+
+void test_gives_up_on_a_server_that_never_answers()
+{
+    startStandIn(STANDIN_SILENT);
+    DeviceVariables vars = {};
+    double started = realMs();
+    TEST_ASSERT_FALSE(fetchDeviceVariables(VARIABLES_URL, vars));
+    TEST_ASSERT_EQUAL(HTTPC_ERROR_READ_TIMEOUT, serverSession.status());
+    TEST_ASSERT_GREATER_OR_EQUAL(REQUEST_TIMEOUT, realMs() - started);
+}
+
+void test_fetches_from_hemsida()
+{
+    const char *port = getenv("GURK_STANDIN_PORT");
+    if (!port)
+    {
+        TEST_IGNORE_MESSAGE("start hemsida/app.py and set GURK_STANDIN_PORT to fetch from it");
+    }
+    uint16_t ownPort = host::serverPort;
+    host::serverPort = atoi(port);
+    DeviceVariables vars = {};
+    bool fetched = fetchDeviceVariables(VARIABLES_URL, vars);
+    serverSession.close();
+    host::serverPort = ownPort;
+
+    TEST_ASSERT_TRUE(fetched);
+    TEST_ASSERT_EQUAL_UINT32(5, vars.watering_time);
+    TEST_ASSERT_EQUAL_INT32(14400, vars.sleep_time);
+}
+
+int main()
+{
+    standInLog = (StandInLog *)mmap(nullptr, sizeof(StandInLog), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    // One listening socket for every stand-in, on a port the kernel picks
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bind(listener, (sockaddr *)&address, size);
+    listen(listener, 4);
+    getsockname(listener, (sockaddr *)&address, &size);
+    host::serverPort = ntohs(address.sin_port);
+    host::realTime = true;
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fetches_the_schedule_as_msgpack);
+    RUN_TEST(test_falls_back_to_json);
+    RUN_TEST(test_skips_a_field_it_does_not_know);
+    RUN_TEST(test_does_not_send_a_body_that_does_not_fit);
+    RUN_TEST(test_unchanged_schedule_comes_from_the_cache_over_the_same_connection);
+    RUN_TEST(test_reconnects_after_an_http10_response);
+    RUN_TEST(test_reads_a_chunked_body_and_keeps_the_connection);
+    RUN_TEST(test_ticks_return_while_the_server_is_slow);
+    RUN_TEST(test_gives_up_on_a_server_that_never_answers);
+    RUN_TEST(test_fetches_from_hemsida);
+    return UNITY_END();
+}
@@ -0,0 +1,352 @@
+#include <unity.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "RtcMemory.cpp"
+#include "Utils.cpp"
+#include "Energy.cpp"
+#include "WakeTimings.cpp"
+#include "RetryPolicy.cpp"
+#include "DebounceFilter.cpp"
+#include "Debounce.cpp"
+#include "MotorController.cpp"
+#include "ValveHealth.cpp"
+#include "FlowMeter.cpp"
+#include "MotorHandler.cpp"
+#include "main.cpp"
+
+// Runs the firmware through a watering day in simulated time. Every boot is
+// a fresh process forked from the test, so nothing but what the chip keeps
+// over deep sleep (the board, in shared memory) carries from one boot to
+// the next, and a checkpoint that does not make it through RTC memory shows
+// up as a missed or late watering. The valve is a cam on the motor: the
+// switch on pinInput reads LOW over the open stretch of the turn.
+
+const unsigned long VALVE_TRAVEL_MS = 2000; // rest to open, and open back to rest
+const unsigned long VALVE_TURN_MS = 2 * VALVE_TRAVEL_MS;
+const unsigned long CONNECT_MS = 2500;
+const unsigned long REQUEST_MS = 1500;
+const uint32_t WATERING_MINUTES = 5;
+const uint32_t POLL_S = 4 * 3600;
+const uint64_t HOUR_US = 3600000000ULL;
+const uint8_t MAX_OPENINGS = 64;
+
+struct Opening
+{
+    uint64_t openedMs; // simulated time the switch went LOW
+    uint64_t closedMs;
+    uint32_t openedBoot;
+    uint32_t closedBoot;
+};
+
+// Everything that outlives a boot: the board, the valve, and what the fake
+// server and the test have seen
+struct World
+{
+    host::Board board;
+    uint32_t boots;
+    uint64_t sleepUs; // asked for by the boot that just ended
+    uint32_t valvePosition; // ms of motor travel from rest, wraps at VALVE_TURN_MS
+    uint64_t openedMs;
+    uint32_t openedBoot;
+    Opening openings[MAX_OPENINGS];
+    uint8_t openingCount;
+    uint64_t wateringAtMs; // next watering on the server, in simulated time
+    uint8_t wateringsReported;
+    uint8_t wateringOnEvents;
+    int32_t rtcDriftPpm; // how much longer than asked for each deep sleep runs
+};
+
+static World *world;
+
+static uint64_t simMs()
+{
+    return world->board.nowUs / 1000;
+}
+
+static int valveSwitch()
+{
+    return world->valvePosition >= VALVE_TRAVEL_MS ? LOW : HIGH;
+}
+
+// Turns the cam while the motor pin is driven, a millisecond at a time
+static void turnValve()
+{
+    if (world->board.pins[pinMotor] != HIGH)
+    {
+        return;
+    }
+    int before = valveSwitch();
+    world->valvePosition = (world->valvePosition + 1) % VALVE_TURN_MS;
+    int after = valveSwitch();
+    world->board.pins[pinInput] = after;
+
+    if (before == HIGH && after == LOW)
+    {
+        world->openedMs = simMs();
+        world->openedBoot = world->boots;
+    }
+    else if (before == LOW && after == HIGH && world->openingCount < MAX_OPENINGS)
+    {
+        world->openings[world->openingCount++] = {world->openedMs, simMs(), world->openedBoot, world->boots};
+    }
+}
+
+// WiFiManager: the station is up a while after waitForWiFi() starts waiting
+void beginWiFi(const char *, const char *)
+{
+}
+
+bool wifiReady()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+
+void waitForWiFi()
+{
+    delay(CONNECT_MS);
+    host::wifiStatus = WL_CONNECTED;
+}
+
+void connectToWiFi(const char *ssid, const char *password)
+{
+    beginWiFi(ssid, password);
+    waitForWiFi();
+}
+
+void disconnectFromWiFi(bool)
+{
+    WiFi.mode(WIFI_OFF);
+}
+
+unsigned long radioOnTime()
+{
+    return 0;
+}
+
+// The server: the next watering until the device reports it done, then the
+// same time the day after
+bool fetchDeviceVariables(const char *, DeviceVariables &vars, void (*whileWaiting)())
+{
+    for (unsigned long ms = 0; ms < REQUEST_MS; ms++)
+    {
+        delay(1);
+        if (whileWaiting)
+        {
+            whileWaiting();
+        }
+    }
+    vars.time_until_watering = ((int64_t)world->wateringAtMs - (int64_t)simMs()) / 1000;
+    vars.watering_time = WATERING_MINUTES;
+    vars.sleep_time = POLL_S;
+    vars.watering_volume = 0;
+    return true;
+}
+
+void queueEvent(EventType type, int16_t value)
+{
+    if (type == EVENT_WATERING && value)
+    {
+        world->wateringOnEvents++;
+    }
+    else if (type == EVENT_WATERING)
+    {
+        world->wateringsReported++;
+        world->wateringAtMs += 24 * 3600000ULL;
+    }
+}
+
+// One boot, in a child process. Returns its exit status: 0 when it went
+// into deep sleep, as every boot should.
+static int boot()
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        alarm(20); // a firmware hang, in real time
+        host::board = &world->board;
+        host::onMillisecond = turnValve;
+        try
+        {
+            setup();
+            for (int i = 0; i < 100; i++)
+            {
+                loop();
+            }
+        }
+        catch (const host::DeepSleep &sleep)
+        {
+            world->sleepUs = sleep.us;
+            fflush(stdout);
+            _exit(0);
+        }
+        catch (const host::Reset &)
+        {
+            fflush(stdout);
+            _exit(2);
+        }
+        fflush(stdout);
+        _exit(3); // never went to sleep
+    }
+
+    int status = -1;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Powers the board on at simulated time zero and runs boot after boot until
+// the clock passes untilUs
+static void runUntil(uint64_t untilUs)
+{
+    host::board = &world->board;
+    while (world->board.nowUs < untilUs)
+    {
+        world->boots++;
+        world->board.pins[pinMotor] = LOW; // outputs come up low after a reset
+        world->board.pins[pinInput] = valveSwitch();
+        TEST_ASSERT_EQUAL_MESSAGE(0, boot(), "boot did not end in deep sleep");
+
+        world->board.nowUs += world->sleepUs + (int64_t)world->sleepUs * world->rtcDriftPpm / 1000000;
+        world->board.bootUs = world->board.nowUs;
+        world->board.resetInfo.reason = REASON_DEEP_SLEEP_AWAKE;
+    }
+}
+
+// Openings longer than the homing nudge at power-on, which passes the open
+// switch, and so what a watering looks like from the valve
+static int waterings(const Opening *found[], int size)
+{
+    int count = 0;
+    for (uint8_t i = 0; i < world->openingCount; i++)
+    {
+        if (world->openings[i].closedMs - world->openings[i].openedMs > 10000 && count < size)
+        {
+            found[count++] = &world->openings[i];
+        }
+    }
+    return count;
+}
+
+static void checkWatering(uint64_t scheduledMs)
+{
+    const Opening *found[4];
+    TEST_ASSERT_EQUAL_MESSAGE(1, waterings(found, 4), "valve opened for a watering once");
+    const Opening &watering = *found[0];
+    printf("Scheduled %.1f s, opened %.1f s, closed %.1f s (boots %u and %u)\n", scheduledMs / 1000.0,
+           watering.openedMs / 1000.0, watering.closedMs / 1000.0, watering.openedBoot, watering.closedBoot);
+
+    // The motor starts within wateringTolerance of the schedule and the
+    // valve is open once it has travelled
+    TEST_ASSERT_GREATER_OR_EQUAL(scheduledMs, watering.openedMs);
+    TEST_ASSERT_LESS_OR_EQUAL(scheduledMs + wateringTolerance + VALVE_TRAVEL_MS, watering.openedMs);
+
+    // Open for watering_time, plus the travel back to rest
+    uint64_t openMs = watering.closedMs - watering.openedMs;
+    TEST_ASSERT_GREATER_OR_EQUAL(WATERING_MINUTES * 60000, openMs);
+    TEST_ASSERT_LESS_OR_EQUAL(WATERING_MINUTES * 60000 + wateringTolerance + VALVE_TRAVEL_MS, openMs);
+
+    TEST_ASSERT_EQUAL(1, world->wateringOnEvents);
+    TEST_ASSERT_EQUAL(1, world->wateringsReported);
+}
+
+void setUp()
+{
+    memset(world, 0, sizeof(*world));
+    world->board = host::POWER_ON;
+}
+
+void tearDown()
+{
+}
+
+void test_waters_on_schedule_across_deep_sleep()
+{
+    uint64_t scheduledMs = 6 * 3600000ULL;
+    world->wateringAtMs = scheduledMs;
+    runUntil(9 * HOUR_US);
+
+    checkWatering(scheduledMs);
+    // Both the wait to open and watering_time are long enough for deep
+    // sleep, so the cycle went through its checkpoint twice
+    const Opening *found[1];
+    waterings(found, 1);
+    TEST_ASSERT_NOT_EQUAL(found[0]->openedBoot, found[0]->closedBoot);
+}
+
+void test_waters_on_schedule_after_a_short_wait()
+{
+    // Due a few seconds after the poll that follows the first sleep, too
+    // soon for another deep sleep
+    uint64_t scheduledMs = POLL_S * 1000ULL + 20000;
+    world->wateringAtMs = scheduledMs;
+    runUntil(6 * HOUR_US);
+
+    checkWatering(scheduledMs);
+}
+
+void test_next_day_is_not_watered_early()
+{
+    uint64_t scheduledMs = 2 * 3600000ULL;
+    world->wateringAtMs = scheduledMs;
+    runUntil(24 * HOUR_US);
+
+    checkWatering(scheduledMs);
+    TEST_ASSERT_EQUAL(scheduledMs + 24 * 3600000ULL, world->wateringAtMs);
+}
+
+void test_waters_on_schedule_with_a_drifting_rtc()
+{
+    // Each deep sleep runs 0.2 % long, 14 s over the two hours left after
+    // the poll that starts the cycle: inside the uncalibrated wake margin,
+    // well outside wateringTolerance
+    world->rtcDriftPpm = 2000;
+    uint64_t scheduledMs = 6 * 3600000ULL;
+    world->wateringAtMs = scheduledMs;
+    runUntil(9 * HOUR_US);
+
+    checkWatering(scheduledMs);
+}
+
+void test_poll_wakes_leave_the_valve_shut()
+{
+    // Nothing due for two days: a day of 4 h polls, each a deep sleep wake
+    world->wateringAtMs = 48 * 3600000ULL;
+    runUntil(24 * HOUR_US);
+
+    TEST_ASSERT_GREATER_OR_EQUAL(6, world->boots);
+    for (uint8_t i = 0; i < world->openingCount; i++)
+    {
+        // Only the homing at power-on may pass the open switch
+        TEST_ASSERT_EQUAL_UINT32(1, world->openings[i].openedBoot);
+    }
+    TEST_ASSERT_EQUAL(HIGH, valveSwitch());
+    TEST_ASSERT_EQUAL(0, world->wateringOnEvents);
+}
+
+void test_valve_moved_during_sleep_is_homed()
+{
+    world->wateringAtMs = 48 * 3600000ULL;
+    runUntil(5 * HOUR_US);
+
+    // Turned into the open stretch while the device slept
+    world->valvePosition = VALVE_TRAVEL_MS + VALVE_TRAVEL_MS / 2;
+    runUntil(9 * HOUR_US);
+
+    TEST_ASSERT_EQUAL(HIGH, valveSwitch());
+    TEST_ASSERT_EQUAL(0, world->wateringOnEvents);
+}
+
+int main()
+{
+    world = (World *)mmap(nullptr, sizeof(World), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_waters_on_schedule_across_deep_sleep);
+    RUN_TEST(test_waters_on_schedule_after_a_short_wait);
+    RUN_TEST(test_next_day_is_not_watered_early);
+    RUN_TEST(test_waters_on_schedule_with_a_drifting_rtc);
+    RUN_TEST(test_poll_wakes_leave_the_valve_shut);
+    RUN_TEST(test_valve_moved_during_sleep_is_homed);
+    return UNITY_END();
+}
@@ -1,5 +1,8 @@
 from flask import Flask, jsonify, request
 from datetime import datetime, timedelta
+import hashlib
+import json
+import msgpack
 import pytz
 from datetime import datetime, timedelta, time
 
@@ -37,10 +40,40 @@ def get_next_watering_time():
 
 
 # Set watering_time to 15 seconds
-watering_time = 1000 * 60 * 5  # 5 minuter
+watering_time = 5  # minuter, enheten räknar om till ms
+sleep_time = 60 * 60 * 4  # 4 timmar
+watering_volume = 0  # liter per vattning, 0 styr på watering_time istället
+
+
+MSGPACK = "application/msgpack"
+
+
+def wants_msgpack():
+    return request.accept_mimetypes.best_match([MSGPACK, "application/json"]) == MSGPACK
+
+
+def encode(**values):
+    # Same fields either way; the device decodes whichever it asked for
+    if wants_msgpack():
+        return app.response_class(msgpack.packb(values), mimetype=MSGPACK)
+    return jsonify(**values)
+
+
+def request_data():
+    if request.mimetype == MSGPACK:
+        return msgpack.unpackb(request.get_data())
+    return request.json
+
+
+def schedule_etag(next_watering_time):
+    # Only the schedule goes into the ETag, not the countdown, so it stays the
+    # same between polls until the next watering time or settings change
+    schedule = f"{next_watering_time.isoformat()}|{watering_time}|{sleep_time}|{watering_volume}"
+    return hashlib.sha1(schedule.encode()).hexdigest()[:16]
 
 
 @app.route("/data", methods=["GET"])
+@app.route("/get_device_variables", methods=["GET"])
 def get_data():
     now = datetime.now(timezone)
     next_watering_time = get_next_watering_time()
@@ -50,12 +83,32 @@ def get_data():
     print(f"Next watering time: {next_watering_time}")
     print(f"Time until watering = {remaining_time} seconds")
 
-    return jsonify(
-        time_until_watering=int(remaining_time),
-        watering_time=watering_time,
-        current_time=now.strftime("%Y-%m-%d %H:%M:%S %Z"),
-        next_watering_time=next_watering_time.strftime("%Y-%m-%d %H:%M:%S %Z"),
-    )
+    etag = schedule_etag(next_watering_time)
+    if request.if_none_match.contains(etag):
+        print(f"Schedule not modified ({etag})")
+        response = app.response_class(status=304)
+    else:
+        response = encode(
+            time_until_watering=int(remaining_time),
+            watering_time=watering_time,
+            sleep_time=sleep_time,
+            watering_volume=watering_volume,
+            current_time=now.strftime("%Y-%m-%d %H:%M:%S %Z"),
+            next_watering_time=next_watering_time.strftime("%Y-%m-%d %H:%M:%S %Z"),
+        )
+    response.set_etag(etag)
+    response.vary.add("Accept")
+    return response
+
+
+@app.route("/set_is_watering", methods=["POST"])
+def set_is_watering():
+    data = request_data()
+    is_watering = data.get("isWatering")
+    log_time = datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+
+    print(f"Watering: {is_watering} ({request.mimetype}), Logged at: {log_time}")
+    return "OK"
 
 
 # Endpoint to handle the request when no HIGH signal is received
@@ -67,6 +120,37 @@ def no_signal():
     return "OK"
 
 
+EVENT_NAMES = {1: "watering", 2: "no_button_signal", 3: "valve_slow", 4: "water_volume_dl"}
+
+
+TIMING_PHASES = ["assoc", "dhcp", "dns", "tls", "ttfb", "decode"]
+# Order of the "energy" array, in ms, followed by the device's uAh estimate
+ENERGY_LOADS = ["cpu", "radio", "tx", "light", "deep", "motor"]
+
+
+# Batched events from the device: {"dropped": n, "events": [[age, type, value], ...]}
+# where age is seconds before the upload, or -1 if the device lost track of time.
+# "timings" optionally carries the latest wake phase durations in microseconds.
+@app.route("/log_events", methods=["POST"])
+def log_events():
+    data = request_data()
+    now = datetime.now(timezone)
+
+    for age, event_type, value in data.get("events", []):
+        name = EVENT_NAMES.get(event_type, f"event {event_type}")
+        when = (now - timedelta(seconds=age)).strftime("%Y-%m-%d %H:%M:%S") if age >= 0 else "unknown time"
+        print(f"Event {name}: {value} at {when}")
+    if data.get("dropped"):
+        print(f"Device dropped {data['dropped']} events")
+    if data.get("timings"):
+        phases = " ".join(f"{name}={us}" for name, us in zip(TIMING_PHASES, data["timings"]))
+        print(f"Wake us: {phases}")
+    if data.get("energy"):
+        # One JSON line per report, the input format of battery_life.py
+        print(f"Energy: {json.dumps(dict(zip(ENERGY_LOADS + ['uah'], data['energy'])))}")
+    return "OK"
+
+
 # Endpoint to log light status
 @app.route("/log_light_status", methods=["POST"])
 def log_light_status():
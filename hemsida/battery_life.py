@@ -0,0 +1,76 @@
+"""Projects battery life from the device's energy reports.
+
+Reads the "Energy: {...}" lines /log_events prints (server logs, or any file
+with one such line per report), recomputes each report's charge with a
+current table and projects how long a battery lasts at that rate.
+
+    python battery_life.py server.log --capacity 2500
+    python battery_life.py server.log --current motor=400000 --current deep=60
+"""
+
+import argparse
+import json
+import sys
+
+# Microamps per load, the same defaults as loadCurrentUa in gurk/src/main.cpp.
+# Radio, tx and motor come on top of cpu.
+CURRENTS_UA = {
+    "cpu": 15000,
+    "radio": 55000,
+    "tx": 100000,
+    "light": 900,
+    "deep": 20,
+    "motor": 250000,
+}
+
+# Loads that together make up wall-clock time
+WALL_LOADS = ["cpu", "light", "deep"]
+
+
+def read_reports(lines):
+    for line in lines:
+        _, marker, payload = line.partition("Energy: ")
+        if marker:
+            yield json.loads(payload)
+
+
+def parse_current(text):
+    name, _, value = text.partition("=")
+    if name not in CURRENTS_UA or not value.isdigit():
+        raise argparse.ArgumentTypeError(f"expected one of {', '.join(CURRENTS_UA)}=<uA>, got {text!r}")
+    return name, int(value)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("logs", nargs="*", help="log files to read, stdin if none")
+    parser.add_argument("--capacity", type=float, default=2000, help="battery capacity in mAh (default 2000)")
+    parser.add_argument("--usable", type=float, default=0.8, help="usable fraction of the capacity (default 0.8)")
+    parser.add_argument("--current", type=parse_current, action="append", default=[], help="override a load, e.g. motor=400000")
+    args = parser.parse_args()
+
+    currents = dict(CURRENTS_UA, **dict(args.current))
+    lines = [line for path in args.logs for line in open(path)] if args.logs else sys.stdin
+    reports = list(read_reports(lines))
+    if not reports:
+        sys.exit("No energy reports found")
+
+    total_ms = {load: sum(report.get(load, 0) for report in reports) for load in currents}
+    wall_hours = sum(total_ms[load] for load in WALL_LOADS) / 3600000
+    if wall_hours == 0:
+        sys.exit("Reports cover no time")
+    charge_uah = {load: total_ms[load] * currents[load] / 3600000 for load in currents}
+    total_uah = sum(charge_uah.values())
+    average_ua = total_uah / wall_hours
+
+    print(f"{len(reports)} reports covering {wall_hours:.1f} h")
+    for load, uah in sorted(charge_uah.items(), key=lambda item: -item[1]):
+        print(f"  {load:6} {total_ms[load] / 1000:10.1f} s {uah / 1000:8.3f} mAh {100 * uah / total_uah:5.1f} %")
+    print(f"Per report: {total_uah / 1000 / len(reports):.3f} mAh, average draw {average_ua / 1000:.3f} mA")
+
+    hours = args.capacity * args.usable * 1000 / average_ua
+    print(f"Projected life on {args.capacity:.0f} mAh ({args.usable:.0%} usable): {hours / 24:.1f} days")
+
+
+if __name__ == "__main__":
+    main()